@@ -0,0 +1,212 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "affinity.h"
+#include <omp.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define AFFINITY_MAX_NODES 64
+#define AFFINITY_MPOL_BIND 2
+#define AFFINITY_MPOL_MF_MOVE (1 << 1)
+
+static int read_cpulist(int node, cpu_set_t *set)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    FILE *fp = fopen(path, "r");
+    if(fp == NULL) return 1;
+
+    CPU_ZERO(set);
+
+    int lo, hi;
+    char sep;
+    while(fscanf(fp, "%d", &lo) == 1)
+    {
+        hi = lo;
+        if(fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+            if(fscanf(fp, "%d", &hi) != 1) break;
+            if(fscanf(fp, "%c", &sep) != 1) sep = '\n';
+        }
+
+        for(int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, set);
+
+        if(sep != ',') break;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int affinity_node_count(void)
+{
+    int count = 0;
+    char path[64];
+
+    for(int node = 0; node < AFFINITY_MAX_NODES; node++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+        if(access(path, F_OK) == 0) count = node + 1;
+    }
+
+    return count > 0 ? count : 1;
+}
+
+int affinity_cpu_node(int cpu)
+{
+    cpu_set_t set;
+    int num_nodes = affinity_node_count();
+
+    for(int node = 0; node < num_nodes; node++)
+    {
+        if(read_cpulist(node, &set)) continue;
+        if(CPU_ISSET(cpu, &set)) return node;
+    }
+
+    return 0;
+}
+
+int affinity_pin_current(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) ? 1 : 0;
+}
+
+// Restricts the calling thread, and any process or threads it later creates, to one node's CPUs
+int affinity_pin_node(int node)
+{
+    cpu_set_t set;
+    if(read_cpulist(node, &set)) return 1;
+
+    return sched_setaffinity(0, sizeof(set), &set) ? 1 : 0;
+}
+
+/*
+ * Pins OpenMP thread t to the t-th allowed CPU, with CPUs ordered node by node.
+ * Combined with schedule(static) this keeps each contiguous block of rows on the
+ * node that first touched it.
+ */
+int affinity_pin_threads(void)
+{
+    return affinity_pin_threads_from(0);
+}
+
+// As affinity_pin_threads, but thread t of the calling thread's team gets CPU first_cpu + t
+int affinity_pin_threads_from(int first_cpu)
+{
+    static cpu_set_t allowed;
+    static int have_allowed = 0;
+    int failed = 0;
+
+    // Captured once so masks narrowed by earlier pinning don't shrink the CPU list
+    #pragma omp critical(affinity_allowed)
+    {
+        if(!have_allowed) {
+            if(sched_getaffinity(0, sizeof(allowed), &allowed)) failed = 1;
+            else have_allowed = 1;
+        }
+    }
+    if(failed || first_cpu < 0) return 1;
+
+    int order[CPU_SETSIZE];
+    int num_cpus = 0;
+    int num_nodes = affinity_node_count();
+
+    cpu_set_t node_set, seen;
+    CPU_ZERO(&seen);
+
+    for(int node = 0; node < num_nodes; node++)
+    {
+        if(read_cpulist(node, &node_set)) continue;
+
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if(CPU_ISSET(cpu, &node_set) && CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &seen)) {
+                order[num_cpus++] = cpu;
+                CPU_SET(cpu, &seen);
+            }
+        }
+    }
+
+    // No sysfs node information, fall back to the plain affinity mask
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &seen)) order[num_cpus++] = cpu;
+    }
+
+    if(num_cpus == 0) return 1;
+
+    #pragma omp parallel reduction(|:failed)
+    {
+        int tid = omp_get_thread_num();
+        failed |= affinity_pin_current(order[(first_cpu + tid) % num_cpus]);
+    }
+
+    return failed;
+}
+
+int affinity_bind_memory(void *ptr, size_t bytes, int node)
+{
+    if(ptr == NULL || node < 0 || node >= AFFINITY_MAX_NODES) return 1;
+    if(bytes == 0) return 0;
+
+    // The range is widened to whole pages, so it must start on one the caller owns outright
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if((size_t)ptr & (page - 1)) return 6;
+
+    size_t length = (bytes + page - 1) & ~(page - 1);
+    unsigned long nodemask = 1UL << node;
+
+    long ret = syscall(SYS_mbind, ptr, length, AFFINITY_MPOL_BIND,
+                       &nodemask, (unsigned long)AFFINITY_MAX_NODES + 1, AFFINITY_MPOL_MF_MOVE);
+
+    return ret ? 2 : 0;
+}
+
+#else
+
+int affinity_node_count(void)
+{
+    return 1;
+}
+
+int affinity_cpu_node(int cpu)
+{
+    return 0;
+}
+
+int affinity_pin_current(int cpu)
+{
+    return 1;
+}
+
+int affinity_pin_node(int node)
+{
+    return 1;
+}
+
+int affinity_pin_threads(void)
+{
+    return 1;
+}
+
+int affinity_pin_threads_from(int first_cpu)
+{
+    return 1;
+}
+
+int affinity_bind_memory(void *ptr, size_t bytes, int node)
+{
+    return ptr == NULL ? 1 : 0;
+}
+
+#endif
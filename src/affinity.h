@@ -0,0 +1,19 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdlib.h>
+
+/* Topology Queries */
+int affinity_node_count(void);
+int affinity_cpu_node(int cpu);
+
+/* Thread Placement */
+int affinity_pin_threads(void);
+int affinity_pin_threads_from(int first_cpu);
+int affinity_pin_current(int cpu);
+int affinity_pin_node(int node);
+
+/* Memory Placement */
+int affinity_bind_memory(void *ptr, size_t bytes, int node);
+
+#endif // AFFINITY_H
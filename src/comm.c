@@ -0,0 +1,542 @@
+#include "comm.h"
+#include "affinity.h"
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define COMM_MAGIC 0x53434D4Cu
+#define COMM_QUEUE_DEPTH 1024
+#define COMM_SPINS_BEFORE_YIELD 64
+#define COMM_WAIT_POLL_NS 1000000L
+
+#define ROUND_UP(x, m) ((((x) + (m) - 1) / (m)) * (m))
+
+// Message counters for the link rank -> rank + 1, each on its own cache line
+typedef struct  {
+    _Alignas(64) atomic_uint_least64_t posted;
+    _Alignas(64) atomic_uint_least64_t consumed;
+} comm_link_t;
+
+struct comm_shared {
+    uint32_t magic;
+    int world_size;
+    atomic_int abort;
+    atomic_uint barrier_count;
+    atomic_uint barrier_generation;
+    comm_link_t links[COMM_MAX_RANKS];
+};
+
+static size_t header_bytes(void)
+{
+    return ROUND_UP(sizeof(comm_shared_t), 4096);
+}
+
+static size_t segment_bytes(int world_size)
+{
+    return header_bytes() + (size_t)world_size * 2 * COMM_CHUNK * sizeof(double);
+}
+
+static int spin_until(Comm *comm, atomic_uint_least64_t *counter, uint64_t value)
+{
+    unsigned spins = 0;
+
+    while(atomic_load_explicit(counter, memory_order_acquire) < value)
+    {
+        if(atomic_load_explicit(&comm->shared->abort, memory_order_relaxed)) return 7;
+
+        if(++spins % COMM_SPINS_BEFORE_YIELD == 0) sched_yield();
+        else _mm_pause();
+    }
+
+    return 0;
+}
+
+// Posts n doubles to this rank's mailbox for the right-hand neighbour
+static int send_chunk(Comm *comm, const double *src, size_t n)
+{
+    comm_link_t *link = &comm->shared->links[comm->rank];
+    uint64_t k = comm->send_seq;
+
+    // Two slots per mailbox: message k may reuse slot k % 2 once message k - 2 was read
+    int ret = spin_until(comm, &link->consumed, k >= 2 ? k - 1 : 0);
+    if(ret) return ret;
+
+    double *slot = comm->mailboxes + ((size_t)comm->rank * 2 + k % 2) * COMM_CHUNK;
+    memcpy(slot, src, n * sizeof(double));
+
+    atomic_store_explicit(&link->posted, k + 1, memory_order_release);
+    comm->send_seq++;
+
+    return 0;
+}
+
+// Reads the next message from the left-hand neighbour, adding into or overwriting dst
+static int recv_chunk(Comm *comm, double *dst, size_t n, int accumulate)
+{
+    int left = (comm->rank + comm->world_size - 1) % comm->world_size;
+    comm_link_t *link = &comm->shared->links[left];
+    uint64_t k = comm->recv_seq;
+
+    int ret = spin_until(comm, &link->posted, k + 1);
+    if(ret) return ret;
+
+    const double *slot = comm->mailboxes + ((size_t)left * 2 + k % 2) * COMM_CHUNK;
+
+    if(accumulate) {
+        #pragma omp simd
+        for(size_t i = 0; i < n; i++) dst[i] += slot[i];
+    } else {
+        memcpy(dst, slot, n * sizeof(double));
+    }
+
+    atomic_store_explicit(&link->consumed, k + 1, memory_order_release);
+    comm->recv_seq++;
+
+    return 0;
+}
+
+/*
+ * Chunked ring all-reduce. Each segment of up to world_size * COMM_CHUNK values is cut
+ * into world_size chunks; a reduce-scatter leaves every chunk fully summed on one rank,
+ * and an all-gather then circulates the sums. Each chunk's sum is computed once, so
+ * all replicas end up bitwise identical.
+ */
+static int allreduce_sum(Comm *comm, double *data, size_t n)
+{
+    int P = comm->world_size;
+    int r = comm->rank;
+    if(P == 1) return 0;
+
+    size_t segment = (size_t)P * COMM_CHUNK;
+    int ret;
+
+    for(size_t off = 0; off < n; off += segment)
+    {
+        size_t len = (n - off < segment) ? n - off : segment;
+        size_t cs = (len + P - 1) / P;
+        double *base = data + off;
+
+        #define CHUNK_BEGIN(i) (((size_t)(i) * cs < len) ? (size_t)(i) * cs : len)
+        #define CHUNK_END(i) ((CHUNK_BEGIN(i) + cs < len) ? CHUNK_BEGIN(i) + cs : len)
+
+        for(int t = 0; t < P - 1; t++)
+        {
+            int si = (r - t + P) % P;
+            int ri = (r - t - 1 + 2 * P) % P;
+
+            ret = send_chunk(comm, base + CHUNK_BEGIN(si), CHUNK_END(si) - CHUNK_BEGIN(si));
+            if(!ret) ret = recv_chunk(comm, base + CHUNK_BEGIN(ri), CHUNK_END(ri) - CHUNK_BEGIN(ri), 1);
+            if(ret) return ret;
+        }
+
+        for(int t = 0; t < P - 1; t++)
+        {
+            int si = (r + 1 - t + P) % P;
+            int ri = (r - t + P) % P;
+
+            ret = send_chunk(comm, base + CHUNK_BEGIN(si), CHUNK_END(si) - CHUNK_BEGIN(si));
+            if(!ret) ret = recv_chunk(comm, base + CHUNK_BEGIN(ri), CHUNK_END(ri) - CHUNK_BEGIN(ri), 0);
+            if(ret) return ret;
+        }
+
+        #undef CHUNK_BEGIN
+        #undef CHUNK_END
+    }
+
+    return 0;
+}
+
+static void* comm_worker(void *arg)
+{
+    Comm *comm = (Comm *)arg;
+
+    for(;;)
+    {
+        Matrix *matrix = spsc_pop(&comm->queue);
+
+        if(matrix == NULL) {
+            pthread_mutex_lock(&comm->lock);
+            while((matrix = spsc_pop(&comm->queue)) == NULL && !atomic_load(&comm->stop))
+            {
+                pthread_cond_wait(&comm->wake, &comm->lock);
+            }
+            pthread_mutex_unlock(&comm->lock);
+
+            if(matrix == NULL) break;
+        }
+
+        if(atomic_load(&comm->status) == 0) {
+            int ret = allreduce_sum(comm, matrix->data, matrix->rows * matrix->cols);
+            if(ret) atomic_store(&comm->status, ret);
+        }
+
+        atomic_fetch_add_explicit(&comm->completed, 1, memory_order_release);
+
+        pthread_mutex_lock(&comm->lock);
+        pthread_cond_broadcast(&comm->drained);
+        pthread_mutex_unlock(&comm->lock);
+    }
+
+    return NULL;
+}
+
+int comm_attach(Comm *comm, const char *name, int rank, int world_size)
+{
+    if(comm == NULL || name == NULL) return 1;
+    if(world_size < 1 || world_size > COMM_MAX_RANKS || rank < 0 || rank >= world_size) return 2;
+
+    memset(comm, 0, sizeof(*comm));
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) return 4;
+
+    size_t bytes = segment_bytes(world_size);
+    void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return 4;
+
+    comm->shared = (comm_shared_t *)base;
+    if(comm->shared->magic != COMM_MAGIC || comm->shared->world_size != world_size) {
+        munmap(base, bytes);
+        return 2;
+    }
+
+    comm->rank = rank;
+    comm->world_size = world_size;
+    comm->segment_bytes = bytes;
+    comm->mailboxes = (double *)((char *)base + header_bytes());
+
+    atomic_init(&comm->stop, 0);
+    atomic_init(&comm->status, 0);
+    atomic_init(&comm->completed, 0);
+
+    if(spsc_init(&comm->queue, COMM_QUEUE_DEPTH)) {
+        munmap(base, bytes);
+        return 4;
+    }
+
+    pthread_mutex_init(&comm->lock, NULL);
+    pthread_cond_init(&comm->wake, NULL);
+    pthread_cond_init(&comm->drained, NULL);
+
+    // Each rank writes its own mailbox first, so its pages are local to that rank
+    memset(comm->mailboxes + (size_t)rank * 2 * COMM_CHUNK, 0, 2 * COMM_CHUNK * sizeof(double));
+
+    return comm_barrier(comm);
+}
+
+void comm_detach(Comm *comm)
+{
+    if(comm == NULL || comm->shared == NULL) return;
+
+    if(comm->thread_started) {
+        pthread_mutex_lock(&comm->lock);
+        atomic_store(&comm->stop, 1);
+        pthread_cond_broadcast(&comm->wake);
+        pthread_mutex_unlock(&comm->lock);
+
+        pthread_join(comm->thread, NULL);
+        comm->thread_started = 0;
+    }
+
+    pthread_mutex_destroy(&comm->lock);
+    pthread_cond_destroy(&comm->wake);
+    pthread_cond_destroy(&comm->drained);
+    spsc_free(&comm->queue);
+
+    munmap(comm->shared, comm->segment_bytes);
+    comm->shared = NULL;
+}
+
+/*
+ * Runs worker in world_size forked processes, one Comm each. Must be called before the
+ * parent starts any OpenMP region, as the runtime's thread pool does not survive fork.
+ * With bind_nodes, rank r is restricted to NUMA node r % nodes before it allocates.
+ */
+int comm_launch(int world_size, int bind_nodes, int (*worker)(Comm *comm, void *arg), void *arg)
+{
+    if(worker == NULL) return 1;
+    if(world_size < 1 || world_size > COMM_MAX_RANKS) return 2;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/scratch_ml_%ld", (long)getpid());
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0) return 4;
+
+    if(ftruncate(fd, (off_t)segment_bytes(world_size))) {
+        close(fd);
+        shm_unlink(name);
+        return 4;
+    }
+
+    comm_shared_t *shared = (comm_shared_t *)mmap(NULL, header_bytes(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shared == MAP_FAILED) {
+        shm_unlink(name);
+        return 4;
+    }
+
+    memset(shared, 0, sizeof(*shared));
+    shared->world_size = world_size;
+    atomic_init(&shared->abort, 0);
+    atomic_init(&shared->barrier_count, 0);
+    atomic_init(&shared->barrier_generation, 0);
+    for(int r = 0; r < COMM_MAX_RANKS; r++)
+    {
+        atomic_init(&shared->links[r].posted, 0);
+        atomic_init(&shared->links[r].consumed, 0);
+    }
+    shared->magic = COMM_MAGIC;
+
+    int num_nodes = affinity_node_count();
+    int launched = 0;
+    int ret = 0;
+
+    for(int r = 0; r < world_size; r++)
+    {
+        pid_t pid = fork();
+
+        if(pid < 0) {
+            atomic_store(&shared->abort, 1);
+            ret = 4;
+            break;
+        }
+
+        if(pid == 0) {
+            if(bind_nodes) affinity_pin_node(r % num_nodes);
+
+            Comm comm;
+            int rc = comm_attach(&comm, name, r, world_size);
+            if(!rc) {
+                rc = worker(&comm, arg);
+                if(!rc) rc = comm_wait_all(&comm);
+
+                // Release ranks blocked on this one before waiting for our own comm thread
+                if(rc) atomic_store(&shared->abort, 1);
+                comm_detach(&comm);
+            }
+
+            _exit(rc == 0 ? 0 : ((rc & 0xFF) ? (rc & 0xFF) : 1));
+        }
+
+        launched++;
+    }
+
+    // A failed rank sets abort so the others stop waiting in their collectives
+    for(int i = 0; i < launched; i++)
+    {
+        int status;
+        if(wait(&status) < 0) break;
+
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            int code = WIFEXITED(status) ? WEXITSTATUS(status) : 8;
+
+            // Ranks released by the abort report 7; keep the original failure instead
+            if(!ret || (ret == 7 && code != 7)) ret = code;
+            atomic_store(&shared->abort, 1);
+        }
+    }
+
+    munmap(shared, header_bytes());
+    shm_unlink(name);
+
+    return ret;
+}
+
+int comm_barrier(Comm *comm)
+{
+    if(comm == NULL || comm->shared == NULL) return 1;
+
+    comm_shared_t *shared = comm->shared;
+    unsigned generation = atomic_load(&shared->barrier_generation);
+
+    if(atomic_fetch_add(&shared->barrier_count, 1) == (unsigned)comm->world_size - 1) {
+        atomic_store(&shared->barrier_count, 0);
+        atomic_fetch_add(&shared->barrier_generation, 1);
+        return 0;
+    }
+
+    unsigned spins = 0;
+    while(atomic_load(&shared->barrier_generation) == generation)
+    {
+        if(atomic_load_explicit(&shared->abort, memory_order_relaxed)) return 7;
+
+        if(++spins % COMM_SPINS_BEFORE_YIELD == 0) sched_yield();
+        else _mm_pause();
+    }
+
+    return 0;
+}
+
+int comm_allreduce_sum(Comm *comm, double *data, size_t n)
+{
+    if(comm == NULL || data == NULL) return 1;
+
+    // Collectives must be issued in the same order on every rank, so drain queued ones first
+    int ret = comm_wait_all(comm);
+    if(ret) return ret;
+
+    return allreduce_sum(comm, data, n);
+}
+
+// Pipelined chain along the ring starting at root
+int comm_broadcast(Comm *comm, double *data, size_t n, int root)
+{
+    if(comm == NULL || data == NULL) return 1;
+    if(root < 0 || root >= comm->world_size) return 2;
+
+    int ret = comm_wait_all(comm);
+    if(ret || comm->world_size == 1) return ret;
+
+    int right = (comm->rank + 1) % comm->world_size;
+
+    for(size_t off = 0; off < n; off += COMM_CHUNK)
+    {
+        size_t len = (n - off < COMM_CHUNK) ? n - off : COMM_CHUNK;
+
+        if(comm->rank != root) {
+            ret = recv_chunk(comm, data + off, len, 0);
+            if(ret) return ret;
+        }
+
+        if(right != root) {
+            ret = send_chunk(comm, data + off, len);
+            if(ret) return ret;
+        }
+    }
+
+    return 0;
+}
+
+// Queues an in-place sum over ranks; the matrix must not be touched until comm_wait_all
+int comm_allreduce_async(Comm *comm, Matrix *matrix)
+{
+    if(comm == NULL || matrix == NULL) return 1;
+    if(comm->world_size == 1) return 0;
+
+    if(!comm->thread_started) {
+        if(pthread_create(&comm->thread, NULL, comm_worker, comm)) {
+            atomic_store(&comm->status, 4);
+            return 4;
+        }
+        comm->thread_started = 1;
+    }
+
+    while(spsc_push(&comm->queue, matrix))
+    {
+        if(atomic_load(&comm->shared->abort)) {
+            atomic_store(&comm->status, 7);
+            return 7;
+        }
+        sched_yield();
+    }
+    comm->enqueued++;
+
+    pthread_mutex_lock(&comm->lock);
+    pthread_cond_signal(&comm->wake);
+    pthread_mutex_unlock(&comm->lock);
+
+    return 0;
+}
+
+int comm_wait_all(Comm *comm)
+{
+    if(comm == NULL) return 1;
+
+    /*
+     * Queued matrices may still be in flight, so this always waits for the worker to
+     * drain. After a failure or an abort the worker skips what is left, and its current
+     * collective returns once abort is raised, so the drain is short. Abort is raised by
+     * another process and cannot signal the condition, hence the timed wait.
+     */
+    pthread_mutex_lock(&comm->lock);
+    while(atomic_load_explicit(&comm->completed, memory_order_acquire) < comm->enqueued)
+    {
+        if(atomic_load(&comm->shared->abort)) {
+            int ok = 0;
+            atomic_compare_exchange_strong(&comm->status, &ok, 7);
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += COMM_WAIT_POLL_NS;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&comm->drained, &comm->lock, &deadline);
+    }
+    pthread_mutex_unlock(&comm->lock);
+
+    return atomic_load(&comm->status);
+}
+
+int comm_broadcast_network(Comm *comm, NeuralNetwork *nn)
+{
+    if(comm == NULL || nn == NULL) return 1;
+
+    int ret;
+    for(size_t i = 0; i < nn->num_layers; i++)
+    {
+        Layer *layer = &nn->layers[i];
+        if(layer->weights->data == NULL) return 6;
+
+        ret = comm_broadcast(comm, layer->weights->data, layer->weights->rows * layer->weights->cols, 0);
+        if(!ret) ret = comm_broadcast(comm, layer->biases->data, layer->biases->rows * layer->biases->cols, 0);
+        if(!ret && layer->weight_format != precision_fp64) ret = layer_set_weight_format(layer, layer->weight_format);
+        if(ret) return ret;
+    }
+
+    return 0;
+}
+
+static void enqueue_gradients(gGraph_t *graph, gOp_t *op, void *ctx)
+{
+    (void)graph;
+    Comm *comm = (Comm *)ctx;
+
+    // A gradient that never reaches the ring must fail the step, or this replica diverges
+    int ret = comm_allreduce_async(comm, op->grad_weights);
+    if(!ret) ret = comm_allreduce_async(comm, op->grad_biases);
+    if(ret) atomic_store(&comm->status, ret);
+}
+
+/*
+ * Data-parallel training step on a captured graph. Each layer's gradients are handed to
+ * the comm thread as soon as its backward op finishes, so the reduction of later layers
+ * overlaps the backward pass of earlier ones.
+ */
+int comm_train_step(Comm *comm, gGraph_t *graph, const Matrix *input, const Matrix *target, double learning_rate, double *loss)
+{
+    if(comm == NULL || graph == NULL) return 1;
+
+    graph->on_gradient = enqueue_gradients;
+    graph->on_gradient_ctx = comm;
+
+    int ret = graph_forward(graph, input, NULL);
+    if(!ret) ret = graph_backward(graph, target);
+
+    graph->on_gradient = NULL;
+    graph->on_gradient_ctx = NULL;
+
+    int wait = comm_wait_all(comm);
+    if(!ret) ret = wait;
+    if(ret) return ret;
+
+    // Reduced gradients are sums over ranks; scaling the step turns them into the mean
+    ret = graph_update(graph, learning_rate / (double)comm->world_size);
+    if(ret || loss == NULL) return ret;
+
+    double global_loss = graph->loss;
+    ret = comm_allreduce_sum(comm, &global_loss, 1);
+    *loss = global_loss / (double)comm->world_size;
+
+    return ret;
+}
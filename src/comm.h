@@ -0,0 +1,59 @@
+#ifndef COMM_H
+#define COMM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "graph.h"
+#include "ring.h"
+
+/*
+ * Collectives between local worker processes over one POSIX shared-memory segment.
+ * Every rank owns a double-buffered mailbox that its right-hand neighbour reads
+ * from, so all traffic follows the ring rank -> rank + 1.
+ */
+
+#define COMM_MAX_RANKS 64
+#define COMM_CHUNK 32768
+
+typedef struct comm_shared comm_shared_t;
+
+typedef struct  {
+    int rank;
+    int world_size;
+    comm_shared_t *shared;
+    size_t segment_bytes;
+    double *mailboxes;
+    uint64_t send_seq;
+    uint64_t recv_seq;
+
+    /* Asynchronous all-reduce, serviced in FIFO order by a per-process thread */
+    spsc_ring_t queue;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t drained;
+    int thread_started;
+    atomic_int stop;
+    atomic_int status;
+    atomic_size_t completed;
+    size_t enqueued;
+} Comm;
+
+/* Launcher */
+int comm_launch(int world_size, int bind_nodes, int (*worker)(Comm *comm, void *arg), void *arg);
+int comm_attach(Comm *comm, const char *name, int rank, int world_size);
+void comm_detach(Comm *comm);
+
+/* Collectives */
+int comm_barrier(Comm *comm);
+int comm_allreduce_sum(Comm *comm, double *data, size_t n);
+int comm_broadcast(Comm *comm, double *data, size_t n, int root);
+int comm_allreduce_async(Comm *comm, Matrix *matrix);
+int comm_wait_all(Comm *comm);
+
+/* Data-Parallel Training */
+int comm_broadcast_network(Comm *comm, NeuralNetwork *nn);
+int comm_train_step(Comm *comm, gGraph_t *graph, const Matrix *input, const Matrix *target, double learning_rate, double *loss);
+
+#endif // COMM_H
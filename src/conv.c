@@ -0,0 +1,493 @@
+#include "conv.h"
+#include "gemm.h"
+#include <omp.h>
+#include <pthread.h>
+#include <stddef.h>
+
+#define ROUND_UP(x, m) ((((x) + (m) - 1) / (m)) * (m))
+
+// Winograd transform buffers, cached per calling thread like the GEMM pack workspace
+static __thread Matrix *winograd_u = NULL;
+static __thread Matrix *winograd_v = NULL;
+static __thread Matrix *winograd_m = NULL;
+
+// Releases the scratch of threads that exit without calling conv_release_workspace
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void scratch_destructor(void *unused)
+{
+    (void)unused;
+    conv_release_workspace();
+}
+
+static void create_scratch_key(void)
+{
+    pthread_key_create(&scratch_key, scratch_destructor);
+}
+
+static double* reserve_scratch(Matrix **scratch, size_t count)
+{
+    if(*scratch != NULL && (*scratch)->cols >= count) return (*scratch)->data;
+
+    pthread_once(&scratch_key_once, create_scratch_key);
+    pthread_setspecific(scratch_key, scratch);
+
+    free_matrix(*scratch);
+    *scratch = initialise_matrix(1, count);
+
+    return *scratch ? (*scratch)->data : NULL;
+}
+
+void conv_release_workspace(void)
+{
+    free_matrix(winograd_u);
+    free_matrix(winograd_v);
+    free_matrix(winograd_m);
+    winograd_u = NULL;
+    winograd_v = NULL;
+    winograd_m = NULL;
+}
+
+int conv_params_init(ConvParams *params, size_t in_h, size_t in_w, size_t in_c, size_t out_c, size_t kernel, size_t stride, size_t padding)
+{
+    if(params == NULL) return 1;
+    if(kernel == 0 || stride == 0 || in_c == 0 || out_c == 0) return 2;
+    if(in_h + 2 * padding < kernel || in_w + 2 * padding < kernel) return 2;
+
+    params->in_h = in_h;
+    params->in_w = in_w;
+    params->in_c = in_c;
+    params->out_c = out_c;
+    params->kernel_h = kernel;
+    params->kernel_w = kernel;
+    params->stride = stride;
+    params->padding = padding;
+    params->out_h = (in_h + 2 * padding - kernel) / stride + 1;
+    params->out_w = (in_w + 2 * padding - kernel) / stride + 1;
+    params->winograd = 0;
+
+    return 0;
+}
+
+int conv_winograd_eligible(const ConvParams *params)
+{
+    return params != NULL && params->kernel_h == 3 && params->kernel_w == 3 && params->stride == 1;
+}
+
+static int check_shapes(const ConvParams *p, const Matrix *input, const Matrix *weights, const Matrix *output)
+{
+    if(input->cols != p->in_h * p->in_w * p->in_c) return 2;
+    if(weights->rows != p->kernel_h * p->kernel_w * p->in_c || weights->cols != p->out_c) return 2;
+    if(output->rows != input->rows || output->cols != p->out_h * p->out_w * p->out_c) return 2;
+
+    return 0;
+}
+
+/*
+ * Forward A operand: row m = (n, oh, ow), column k = (kh, kw, c). Only the requested
+ * panel is gathered from the input, so the full im2col matrix is never built.
+ */
+static void pack_a_im2col(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    const ConvParams *p = (const ConvParams *)src->ctx;
+    const double *input = (const double *)src->data;
+    size_t in_sample = p->in_h * p->in_w * p->in_c;
+
+    for(size_t i = 0; i < ROUND_UP(rows, GEMM_MR); i++)
+    {
+        double *dst = panel + (i / GEMM_MR) * GEMM_MR * cols + (i % GEMM_MR);
+
+        if(i >= rows) {
+            for(size_t j = 0; j < cols; j++) dst[j * GEMM_MR] = 0.0;
+            continue;
+        }
+
+        size_t m = row0 + i;
+        size_t ow = m % p->out_w;
+        size_t oh = (m / p->out_w) % p->out_h;
+        size_t n = m / (p->out_w * p->out_h);
+
+        const double *sample = input + n * in_sample;
+        ptrdiff_t ih0 = (ptrdiff_t)(oh * p->stride) - (ptrdiff_t)p->padding;
+        ptrdiff_t iw0 = (ptrdiff_t)(ow * p->stride) - (ptrdiff_t)p->padding;
+
+        size_t c = col0 % p->in_c;
+        size_t kw = (col0 / p->in_c) % p->kernel_w;
+        size_t kh = col0 / (p->in_c * p->kernel_w);
+
+        for(size_t j = 0; j < cols; j++)
+        {
+            ptrdiff_t ih = ih0 + (ptrdiff_t)kh;
+            ptrdiff_t iw = iw0 + (ptrdiff_t)kw;
+
+            if(ih >= 0 && ih < (ptrdiff_t)p->in_h && iw >= 0 && iw < (ptrdiff_t)p->in_w) {
+                dst[j * GEMM_MR] = sample[((size_t)ih * p->in_w + (size_t)iw) * p->in_c + c];
+            } else {
+                dst[j * GEMM_MR] = 0.0;
+            }
+
+            if(++c == p->in_c) {
+                c = 0;
+                if(++kw == p->kernel_w) {
+                    kw = 0;
+                    kh++;
+                }
+            }
+        }
+    }
+}
+
+// Weight-gradient A operand: the transpose of the im2col matrix, row k, column m
+static void pack_a_im2col_t(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    const ConvParams *p = (const ConvParams *)src->ctx;
+    const double *input = (const double *)src->data;
+    size_t in_sample = p->in_h * p->in_w * p->in_c;
+
+    for(size_t j = 0; j < cols; j++)
+    {
+        size_t m = col0 + j;
+        size_t ow = m % p->out_w;
+        size_t oh = (m / p->out_w) % p->out_h;
+        size_t n = m / (p->out_w * p->out_h);
+
+        const double *sample = input + n * in_sample;
+        ptrdiff_t ih0 = (ptrdiff_t)(oh * p->stride) - (ptrdiff_t)p->padding;
+        ptrdiff_t iw0 = (ptrdiff_t)(ow * p->stride) - (ptrdiff_t)p->padding;
+
+        size_t c = row0 % p->in_c;
+        size_t kw = (row0 / p->in_c) % p->kernel_w;
+        size_t kh = row0 / (p->in_c * p->kernel_w);
+
+        for(size_t i = 0; i < ROUND_UP(rows, GEMM_MR); i++)
+        {
+            double *dst = panel + (i / GEMM_MR) * GEMM_MR * cols + j * GEMM_MR + (i % GEMM_MR);
+            ptrdiff_t ih = ih0 + (ptrdiff_t)kh;
+            ptrdiff_t iw = iw0 + (ptrdiff_t)kw;
+
+            if(i < rows && ih >= 0 && ih < (ptrdiff_t)p->in_h && iw >= 0 && iw < (ptrdiff_t)p->in_w) {
+                *dst = sample[((size_t)ih * p->in_w + (size_t)iw) * p->in_c + c];
+            } else {
+                *dst = 0.0;
+            }
+
+            if(++c == p->in_c) {
+                c = 0;
+                if(++kw == p->kernel_w) {
+                    kw = 0;
+                    kh++;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Input-gradient A operand, written as a gather so no two threads ever scatter into
+ * the same input pixel: row (n, ih, iw), column (kh, kw, oc) picks the output
+ * gradient of the window position that read input (ih, iw) through tap (kh, kw).
+ */
+static void pack_a_col2im(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    const ConvParams *p = (const ConvParams *)src->ctx;
+    const double *grad_output = (const double *)src->data;
+    size_t out_sample = p->out_h * p->out_w * p->out_c;
+
+    for(size_t i = 0; i < ROUND_UP(rows, GEMM_MR); i++)
+    {
+        double *dst = panel + (i / GEMM_MR) * GEMM_MR * cols + (i % GEMM_MR);
+
+        if(i >= rows) {
+            for(size_t j = 0; j < cols; j++) dst[j * GEMM_MR] = 0.0;
+            continue;
+        }
+
+        size_t r = row0 + i;
+        size_t iw = r % p->in_w;
+        size_t ih = (r / p->in_w) % p->in_h;
+        size_t n = r / (p->in_w * p->in_h);
+
+        const double *sample = grad_output + n * out_sample;
+
+        size_t oc = col0 % p->out_c;
+        size_t kw = (col0 / p->out_c) % p->kernel_w;
+        size_t kh = col0 / (p->out_c * p->kernel_w);
+
+        for(size_t j = 0; j < cols; j++)
+        {
+            ptrdiff_t oh_s = (ptrdiff_t)(ih + p->padding) - (ptrdiff_t)kh;
+            ptrdiff_t ow_s = (ptrdiff_t)(iw + p->padding) - (ptrdiff_t)kw;
+            double val = 0.0;
+
+            if(oh_s >= 0 && ow_s >= 0 && (size_t)oh_s % p->stride == 0 && (size_t)ow_s % p->stride == 0) {
+                size_t oh = (size_t)oh_s / p->stride;
+                size_t ow = (size_t)ow_s / p->stride;
+                if(oh < p->out_h && ow < p->out_w) val = sample[(oh * p->out_w + ow) * p->out_c + oc];
+            }
+
+            dst[j * GEMM_MR] = val;
+
+            if(++oc == p->out_c) {
+                oc = 0;
+                if(++kw == p->kernel_w) {
+                    kw = 0;
+                    kh++;
+                }
+            }
+        }
+    }
+}
+
+// Input-gradient B operand: weights re-indexed as row (kh, kw, oc), column c
+static void pack_b_weights_t(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    const ConvParams *p = (const ConvParams *)src->ctx;
+    const double *weights = (const double *)src->data;
+
+    for(size_t q = 0; q < cols; q += GEMM_NR)
+    {
+        double *dst = panel + q * rows;
+
+        size_t oc = row0 % p->out_c;
+        size_t kw = (row0 / p->out_c) % p->kernel_w;
+        size_t kh = row0 / (p->out_c * p->kernel_w);
+
+        for(size_t k = 0; k < rows; k++)
+        {
+            const double *tap = weights + (kh * p->kernel_w + kw) * p->in_c * p->out_c + oc;
+
+            for(size_t c = 0; c < GEMM_NR; c++)
+            {
+                dst[k * GEMM_NR + c] = (q + c < cols) ? tap[(col0 + q + c) * p->out_c] : 0.0;
+            }
+
+            if(++oc == p->out_c) {
+                oc = 0;
+                if(++kw == p->kernel_w) {
+                    kw = 0;
+                    kh++;
+                }
+            }
+        }
+    }
+}
+
+int conv2d_forward(const ConvParams *params, const Matrix *input, const Matrix *weights, Matrix *output)
+{
+    if(params == NULL || input == NULL || weights == NULL || output == NULL) return 1;
+
+    int ret = check_shapes(params, input, weights, output);
+    if(ret) return ret;
+
+    if(params->winograd && conv_winograd_eligible(params)) {
+        return conv2d_forward_winograd(params, input, weights, output);
+    }
+
+    gemm_src_t B = gemm_src_b(weights->data, weights->cols, 0);
+    return conv2d_forward_packed(params, input, &B, output);
+}
+
+// Forward pass with the weights supplied as a GEMM B operand, e.g. reduced-precision storage
+int conv2d_forward_packed(const ConvParams *params, const Matrix *input, const gemm_src_t *weights, Matrix *output)
+{
+    if(params == NULL || input == NULL || weights == NULL || output == NULL) return 1;
+    if(input->cols != params->in_h * params->in_w * params->in_c) return 2;
+    if(output->rows != input->rows || output->cols != params->out_h * params->out_w * params->out_c) return 2;
+
+    size_t M = input->rows * params->out_h * params->out_w;
+    size_t K = params->kernel_h * params->kernel_w * params->in_c;
+
+    gemm_src_t A = { input->data, 0, 0, params, pack_a_im2col };
+
+    // NHWC output is exactly the (M x out_c) GEMM result
+    return gemm_packed(M, params->out_c, K, &A, weights, output->data, params->out_c, 0);
+}
+
+int conv2d_backward(const ConvParams *params, const Matrix *input, const Matrix *weights, const Matrix *grad_output, Matrix *grad_input, Matrix *grad_weights)
+{
+    if(params == NULL || input == NULL || weights == NULL || grad_output == NULL || grad_weights == NULL) return 1;
+
+    int ret = check_shapes(params, input, weights, grad_output);
+    if(ret) return ret;
+    if(grad_weights->rows != weights->rows || grad_weights->cols != weights->cols) return 2;
+
+    size_t positions = input->rows * params->out_h * params->out_w;
+    size_t K = params->kernel_h * params->kernel_w * params->in_c;
+
+    // dW = im2col(X)^T * dY
+    gemm_src_t A = { input->data, 0, 0, params, pack_a_im2col_t };
+    gemm_src_t B = gemm_src_b(grad_output->data, params->out_c, 0);
+
+    ret = gemm_packed(K, params->out_c, positions, &A, &B, grad_weights->data, params->out_c, 0);
+    if(ret) return ret;
+
+    if(grad_input == NULL) return 0;
+    if(grad_input->rows != input->rows || grad_input->cols != input->cols) return 2;
+
+    // dX = gather(dY) * W', accumulated per input pixel
+    gemm_src_t dA = { grad_output->data, 0, 0, params, pack_a_col2im };
+    gemm_src_t dB = { weights->data, 0, 0, params, pack_b_weights_t };
+
+    size_t in_positions = input->rows * params->in_h * params->in_w;
+    size_t dK = params->kernel_h * params->kernel_w * params->out_c;
+
+    return gemm_packed(in_positions, params->in_c, dK, &dA, &dB, grad_input->data, params->in_c, 0);
+}
+
+/*
+ * Winograd F(2x2, 3x3): each 2x2 output tile is computed from a 4x4 input tile with
+ * 16 multiplies instead of 36. The channel reduction becomes 16 independent GEMMs,
+ * one per transformed tile element.
+ */
+int conv2d_forward_winograd(const ConvParams *params, const Matrix *input, const Matrix *weights, Matrix *output)
+{
+    if(params == NULL || input == NULL || weights == NULL || output == NULL) return 1;
+    if(!conv_winograd_eligible(params)) return 6;
+
+    int ret = check_shapes(params, input, weights, output);
+    if(ret) return ret;
+
+    const ConvParams *p = params;
+    size_t C = p->in_c, OC = p->out_c;
+    size_t tiles_h = (p->out_h + 1) / 2;
+    size_t tiles_w = (p->out_w + 1) / 2;
+    size_t T = input->rows * tiles_h * tiles_w;
+
+    // Every element of U, V and Mt is written below, so reused scratch needs no clearing
+    double *U = reserve_scratch(&winograd_u, 16 * C * OC);
+    double *V = reserve_scratch(&winograd_v, 16 * T * C);
+    double *Mt = reserve_scratch(&winograd_m, 16 * T * OC);
+    if(U == NULL || V == NULL || Mt == NULL) return 4;
+
+    // Filter transform U = G g G^T
+    #pragma omp parallel for schedule(static)
+    for(size_t c = 0; c < C; c++)
+    {
+        for(size_t oc = 0; oc < OC; oc++)
+        {
+            double g[3][3], t[4][3], u[4][4];
+
+            for(size_t kh = 0; kh < 3; kh++)
+                for(size_t kw = 0; kw < 3; kw++)
+                    g[kh][kw] = weights->data[((kh * 3 + kw) * C + c) * OC + oc];
+
+            for(size_t j = 0; j < 3; j++)
+            {
+                t[0][j] = g[0][j];
+                t[1][j] = 0.5 * (g[0][j] + g[1][j] + g[2][j]);
+                t[2][j] = 0.5 * (g[0][j] - g[1][j] + g[2][j]);
+                t[3][j] = g[2][j];
+            }
+
+            for(size_t i = 0; i < 4; i++)
+            {
+                u[i][0] = t[i][0];
+                u[i][1] = 0.5 * (t[i][0] + t[i][1] + t[i][2]);
+                u[i][2] = 0.5 * (t[i][0] - t[i][1] + t[i][2]);
+                u[i][3] = t[i][2];
+            }
+
+            for(size_t xi = 0; xi < 16; xi++)
+                U[(xi * C + c) * OC + oc] = u[xi / 4][xi % 4];
+        }
+    }
+
+    // Input transform V = B^T d B
+    size_t in_sample = p->in_h * p->in_w * C;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t tile = 0; tile < T; tile++)
+    {
+        size_t tw = tile % tiles_w;
+        size_t th = (tile / tiles_w) % tiles_h;
+        size_t n = tile / (tiles_w * tiles_h);
+
+        const double *sample = input->data + n * in_sample;
+        ptrdiff_t ih0 = (ptrdiff_t)(2 * th) - (ptrdiff_t)p->padding;
+        ptrdiff_t iw0 = (ptrdiff_t)(2 * tw) - (ptrdiff_t)p->padding;
+
+        for(size_t c = 0; c < C; c++)
+        {
+            double d[4][4], t[4][4];
+
+            for(size_t i = 0; i < 4; i++)
+            {
+                for(size_t j = 0; j < 4; j++)
+                {
+                    ptrdiff_t ih = ih0 + (ptrdiff_t)i;
+                    ptrdiff_t iw = iw0 + (ptrdiff_t)j;
+                    int inside = ih >= 0 && ih < (ptrdiff_t)p->in_h && iw >= 0 && iw < (ptrdiff_t)p->in_w;
+                    d[i][j] = inside ? sample[((size_t)ih * p->in_w + (size_t)iw) * C + c] : 0.0;
+                }
+            }
+
+            for(size_t j = 0; j < 4; j++)
+            {
+                t[0][j] = d[0][j] - d[2][j];
+                t[1][j] = d[1][j] + d[2][j];
+                t[2][j] = d[2][j] - d[1][j];
+                t[3][j] = d[1][j] - d[3][j];
+            }
+
+            for(size_t i = 0; i < 4; i++)
+            {
+                double *v = V + ((i * 4) * T + tile) * C + c;
+                v[0 * T * C] = t[i][0] - t[i][2];
+                v[1 * T * C] = t[i][1] + t[i][2];
+                v[2 * T * C] = t[i][2] - t[i][1];
+                v[3 * T * C] = t[i][1] - t[i][3];
+            }
+        }
+    }
+
+    // Elementwise product in the transformed domain, reduced over channels
+    for(size_t xi = 0; xi < 16 && !ret; xi++)
+    {
+        gemm_src_t A = gemm_src_a(V + xi * T * C, C, 0);
+        gemm_src_t B = gemm_src_b(U + xi * C * OC, OC, 0);
+        ret = gemm_packed(T, OC, C, &A, &B, Mt + xi * T * OC, OC, 0);
+    }
+
+    // Output transform Y = A^T M A
+    size_t out_sample = p->out_h * p->out_w * OC;
+
+    if(!ret) {
+        #pragma omp parallel for schedule(static)
+        for(size_t tile = 0; tile < T; tile++)
+        {
+            size_t tw = tile % tiles_w;
+            size_t th = (tile / tiles_w) % tiles_h;
+            size_t n = tile / (tiles_w * tiles_h);
+            double *sample = output->data + n * out_sample;
+
+            for(size_t oc = 0; oc < OC; oc++)
+            {
+                double m[4][4], t[2][4];
+
+                for(size_t xi = 0; xi < 16; xi++)
+                    m[xi / 4][xi % 4] = Mt[(xi * T + tile) * OC + oc];
+
+                for(size_t j = 0; j < 4; j++)
+                {
+                    t[0][j] = m[0][j] + m[1][j] + m[2][j];
+                    t[1][j] = m[1][j] - m[2][j] - m[3][j];
+                }
+
+                for(size_t i = 0; i < 2; i++)
+                {
+                    size_t oh = 2 * th + i;
+                    if(oh >= p->out_h) break;
+
+                    double y0 = t[i][0] + t[i][1] + t[i][2];
+                    double y1 = t[i][1] - t[i][2] - t[i][3];
+
+                    sample[(oh * p->out_w + 2 * tw) * OC + oc] = y0;
+                    if(2 * tw + 1 < p->out_w) sample[(oh * p->out_w + 2 * tw + 1) * OC + oc] = y1;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef CONV_H
+#define CONV_H
+
+#include <stdlib.h>
+#include "gemm.h"
+#include "matrix.h"
+
+/*
+ * Activations are stored one sample per row in NHWC order, i.e. a (batch x H*W*C)
+ * Matrix. Weights are a (kernel_h*kernel_w*in_c x out_c) Matrix with rows ordered
+ * (kh, kw, c), which is the B operand of the lowered GEMM.
+ */
+typedef struct  {
+    size_t in_h, in_w, in_c;
+    size_t out_h, out_w, out_c;
+    size_t kernel_h, kernel_w;
+    size_t stride;
+    size_t padding;
+    int winograd;
+} ConvParams;
+
+int conv_params_init(ConvParams *params, size_t in_h, size_t in_w, size_t in_c, size_t out_c, size_t kernel, size_t stride, size_t padding);
+int conv_winograd_eligible(const ConvParams *params);
+
+/* Convolution Operations */
+int conv2d_forward(const ConvParams *params, const Matrix *input, const Matrix *weights, Matrix *output);
+int conv2d_forward_packed(const ConvParams *params, const Matrix *input, const gemm_src_t *weights, Matrix *output);
+int conv2d_forward_winograd(const ConvParams *params, const Matrix *input, const Matrix *weights, Matrix *output);
+int conv2d_backward(const ConvParams *params, const Matrix *input, const Matrix *weights, const Matrix *grad_output, Matrix *grad_input, Matrix *grad_weights);
+void conv_release_workspace(void);
+
+#endif // CONV_H
@@ -0,0 +1,389 @@
+#include "gemm.h"
+#include <immintrin.h>
+#include <omp.h>
+#include <pthread.h>
+#include <string.h>
+
+#define ROUND_UP(x, m) ((((x) + (m) - 1) / (m)) * (m))
+
+// Pack buffers are cached per calling thread, so repeated calls (e.g. graph replay) don't allocate
+static __thread Matrix *workspace_a = NULL;
+static __thread Matrix *workspace_b = NULL;
+
+// Releases the workspace of threads that exit without calling gemm_release_workspace
+static pthread_key_t workspace_key;
+static pthread_once_t workspace_key_once = PTHREAD_ONCE_INIT;
+
+static void workspace_destructor(void *unused)
+{
+    (void)unused;
+    gemm_release_workspace();
+}
+
+static void create_workspace_key(void)
+{
+    pthread_key_create(&workspace_key, workspace_destructor);
+}
+
+static Matrix* reserve_workspace(Matrix **workspace, size_t rows, size_t cols)
+{
+    Matrix *ws = *workspace;
+    if(ws != NULL && ws->rows >= rows && ws->cols >= cols) return ws;
+
+    pthread_once(&workspace_key_once, create_workspace_key);
+    pthread_setspecific(workspace_key, workspace);
+
+    if(ws != NULL) {
+        if(ws->rows > rows) rows = ws->rows;
+        if(ws->cols > cols) cols = ws->cols;
+        free_matrix(ws);
+    }
+
+    *workspace = initialise_matrix(rows, cols);
+    return *workspace;
+}
+
+void gemm_release_workspace(void)
+{
+    free_matrix(workspace_a);
+    free_matrix(workspace_b);
+    workspace_a = NULL;
+    workspace_b = NULL;
+}
+
+gemm_src_t gemm_src_a(const double *data, size_t ld, int trans)
+{
+    gemm_src_t src = { data, ld, trans, NULL, gemm_pack_a };
+    return src;
+}
+
+gemm_src_t gemm_src_b(const double *data, size_t ld, int trans)
+{
+    gemm_src_t src = { data, ld, trans, NULL, gemm_pack_b };
+    return src;
+}
+
+void gemm_pack_a(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    const double *data = (const double *)src->data;
+    size_t ld = src->ld;
+
+    for(size_t p = 0; p < rows; p += GEMM_MR)
+    {
+        double *dst = panel + p * cols;
+        size_t mr = (rows - p < GEMM_MR) ? rows - p : GEMM_MR;
+
+        for(size_t k = 0; k < cols; k++)
+        {
+            for(size_t r = 0; r < GEMM_MR; r++)
+            {
+                if(r >= mr) {
+                    dst[k * GEMM_MR + r] = 0.0;
+                } else if(src->trans) {
+                    dst[k * GEMM_MR + r] = data[(col0 + k) * ld + (row0 + p + r)];
+                } else {
+                    dst[k * GEMM_MR + r] = data[(row0 + p + r) * ld + (col0 + k)];
+                }
+            }
+        }
+    }
+}
+
+void gemm_pack_b(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    const double *data = (const double *)src->data;
+    size_t ld = src->ld;
+
+    for(size_t q = 0; q < cols; q += GEMM_NR)
+    {
+        double *dst = panel + q * rows;
+        size_t nr = (cols - q < GEMM_NR) ? cols - q : GEMM_NR;
+
+        for(size_t k = 0; k < rows; k++)
+        {
+            for(size_t c = 0; c < GEMM_NR; c++)
+            {
+                if(c >= nr) {
+                    dst[k * GEMM_NR + c] = 0.0;
+                } else if(src->trans) {
+                    dst[k * GEMM_NR + c] = data[(col0 + q + c) * ld + (row0 + k)];
+                } else {
+                    dst[k * GEMM_NR + c] = data[(row0 + k) * ld + (col0 + q + c)];
+                }
+            }
+        }
+    }
+}
+
+/*
+ * B-side packers for bf16/fp16 storage. Values are widened to double while packing, so
+ * only the narrow weights are streamed from memory and the micro-kernel is unchanged.
+ */
+static inline void widen_row8(const uint16_t *src, double *dst, precision_t format)
+{
+#if defined(__F16C__)
+    if(format == precision_fp16) {
+        __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)src));
+        _mm256_storeu_pd(dst, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+        _mm256_storeu_pd(dst + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+        return;
+    }
+#endif
+#if defined(__AVX2__)
+    if(format == precision_bf16) {
+        __m256i u = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)src)), 16);
+        __m256 f = _mm256_castsi256_ps(u);
+        _mm256_storeu_pd(dst, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+        _mm256_storeu_pd(dst + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+        return;
+    }
+#endif
+    for(size_t c = 0; c < GEMM_NR; c++)
+    {
+        dst[c] = (format == precision_bf16) ? bf16_to_double(src[c]) : fp16_to_double(src[c]);
+    }
+}
+
+static void pack_b_reduced(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel, precision_t format)
+{
+    const uint16_t *data = (const uint16_t *)src->data;
+    size_t ld = src->ld;
+
+    for(size_t q = 0; q < cols; q += GEMM_NR)
+    {
+        double *dst = panel + q * rows;
+        size_t nr = (cols - q < GEMM_NR) ? cols - q : GEMM_NR;
+
+        for(size_t k = 0; k < rows; k++)
+        {
+            if(!src->trans && nr == GEMM_NR) {
+                widen_row8(data + (row0 + k) * ld + (col0 + q), dst + k * GEMM_NR, format);
+                continue;
+            }
+
+            for(size_t c = 0; c < GEMM_NR; c++)
+            {
+                uint16_t h;
+                if(c >= nr) {
+                    dst[k * GEMM_NR + c] = 0.0;
+                    continue;
+                } else if(src->trans) {
+                    h = data[(col0 + q + c) * ld + (row0 + k)];
+                } else {
+                    h = data[(row0 + k) * ld + (col0 + q + c)];
+                }
+                dst[k * GEMM_NR + c] = (format == precision_bf16) ? bf16_to_double(h) : fp16_to_double(h);
+            }
+        }
+    }
+}
+
+static void pack_b_bf16(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    pack_b_reduced(src, row0, col0, rows, cols, panel, precision_bf16);
+}
+
+static void pack_b_fp16(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel)
+{
+    pack_b_reduced(src, row0, col0, rows, cols, panel, precision_fp16);
+}
+
+gemm_src_t gemm_src_b_reduced(const uint16_t *data, size_t ld, int trans, precision_t format)
+{
+    gemm_src_t src = { data, ld, trans, NULL, format == precision_fp16 ? pack_b_fp16 : pack_b_bf16 };
+    return src;
+}
+
+// C[mr x nr] += A_panel * B_panel for one GEMM_MR x GEMM_NR register tile
+static void micro_kernel(size_t kc, const double *a, const double *b, double *C, size_t ldc, size_t mr, size_t nr)
+{
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+
+    for(size_t k = 0; k < kc; k++)
+    {
+        __m256d b0 = _mm256_loadu_pd(b + k * GEMM_NR);
+        __m256d b1 = _mm256_loadu_pd(b + k * GEMM_NR + 4);
+
+        __m256d a0 = _mm256_broadcast_sd(a + k * GEMM_MR);
+        c00 = _mm256_add_pd(c00, _mm256_mul_pd(a0, b0));
+        c01 = _mm256_add_pd(c01, _mm256_mul_pd(a0, b1));
+
+        __m256d a1 = _mm256_broadcast_sd(a + k * GEMM_MR + 1);
+        c10 = _mm256_add_pd(c10, _mm256_mul_pd(a1, b0));
+        c11 = _mm256_add_pd(c11, _mm256_mul_pd(a1, b1));
+
+        __m256d a2 = _mm256_broadcast_sd(a + k * GEMM_MR + 2);
+        c20 = _mm256_add_pd(c20, _mm256_mul_pd(a2, b0));
+        c21 = _mm256_add_pd(c21, _mm256_mul_pd(a2, b1));
+
+        __m256d a3 = _mm256_broadcast_sd(a + k * GEMM_MR + 3);
+        c30 = _mm256_add_pd(c30, _mm256_mul_pd(a3, b0));
+        c31 = _mm256_add_pd(c31, _mm256_mul_pd(a3, b1));
+    }
+
+    double tile[GEMM_MR * GEMM_NR];
+    _mm256_storeu_pd(tile + 0, c00);
+    _mm256_storeu_pd(tile + 4, c01);
+    _mm256_storeu_pd(tile + 8, c10);
+    _mm256_storeu_pd(tile + 12, c11);
+    _mm256_storeu_pd(tile + 16, c20);
+    _mm256_storeu_pd(tile + 20, c21);
+    _mm256_storeu_pd(tile + 24, c30);
+    _mm256_storeu_pd(tile + 28, c31);
+
+    for(size_t r = 0; r < mr; r++)
+    {
+        for(size_t c = 0; c < nr; c++)
+        {
+            C[r * ldc + c] += tile[r * GEMM_NR + c];
+        }
+    }
+}
+
+static void macro_kernel(size_t mc, size_t nc, size_t kc, const double *packed_a, const double *packed_b, double *C, size_t ldc)
+{
+    for(size_t jr = 0; jr < nc; jr += GEMM_NR)
+    {
+        size_t nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+        for(size_t ir = 0; ir < mc; ir += GEMM_MR)
+        {
+            size_t mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+            micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc, C + ir * ldc + jr, ldc, mr, nr);
+        }
+    }
+}
+
+/*
+ * Goto-style blocked GEMM, C = A * B (or C += A * B when accumulating). Operands are
+ * only ever read through their pack routines, so callers can synthesise panels on the
+ * fly (e.g. im2col) instead of materialising the full operand.
+ */
+int gemm_packed(size_t M, size_t N, size_t K, const gemm_src_t *A, const gemm_src_t *B, double *C, size_t ldc, int accumulate)
+{
+    if(A == NULL || B == NULL || C == NULL) return 1;
+    if(ldc < N) return 2;
+
+    // Rows are split with matrix_row_range, the partition fill_matrix first-touches C with
+    if(!accumulate) {
+        #pragma omp parallel
+        {
+            size_t row_begin, row_end;
+            matrix_row_range(M, omp_get_thread_num(), omp_get_num_threads(), &row_begin, &row_end);
+
+            for(size_t i = row_begin; i < row_end; i++)
+            {
+                memset(C + i * ldc, 0, N * sizeof(double));
+            }
+        }
+    }
+
+    if(M == 0 || N == 0 || K == 0) return 0;
+
+    size_t kc_max = (K < GEMM_KC) ? K : GEMM_KC;
+    size_t nc_max = ROUND_UP((N < GEMM_NC) ? N : GEMM_NC, GEMM_NR);
+    size_t mc_max = ROUND_UP((M < GEMM_MC) ? M : GEMM_MC, GEMM_MR);
+    int num_threads = omp_get_max_threads();
+
+    // One A panel per thread, each first touched by the thread that packs into it
+    Matrix *packed_b = reserve_workspace(&workspace_b, 1, kc_max * nc_max);
+    Matrix *packed_a = reserve_workspace(&workspace_a, (size_t)num_threads, (mc_max + GEMM_MR) * kc_max);
+    if(packed_b == NULL || packed_a == NULL) return 4;
+
+    /*
+     * Each thread computes the rows it first-touched. With fewer row blocks than threads
+     * (small batches) that would leave each thread a sliver of rows and the whole of B to
+     * stream, so threads instead form groups of n_parts neighbours: a group covers its
+     * members' rows, packs them together, and each member takes a column slice of them.
+     */
+    size_t m_blocks = (M + GEMM_MC - 1) / GEMM_MC;
+    size_t n_parts = (m_blocks < (size_t)num_threads) ? ((size_t)num_threads + m_blocks - 1) / m_blocks : 1;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int team = omp_get_num_threads();
+        int tid = omp_get_thread_num();
+        int first = tid - tid % (int)n_parts;
+        int last = (first + (int)n_parts < team) ? first + (int)n_parts : team;
+        size_t part = (size_t)(tid - first);
+        size_t parts = (size_t)(last - first);
+
+        size_t row_begin, row_end, unused;
+        matrix_row_range(M, first, team, &row_begin, &unused);
+        matrix_row_range(M, last - 1, team, &unused, &row_end);
+
+        // Per-thread panel, or the group's packed rows (each group packs at most GEMM_MR extra)
+        double *a_panel = (n_parts == 1)
+            ? packed_a->data + (size_t)tid * packed_a->cols
+            : packed_a->data + (row_begin + (size_t)(first / (int)n_parts) * GEMM_MR) * kc_max;
+
+        for(size_t jc = 0; jc < N; jc += GEMM_NC)
+        {
+            size_t nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+            size_t slice = ROUND_UP((nc + parts - 1) / parts, GEMM_NR);
+            size_t js = part * slice;
+            size_t ns = (js < nc) ? ((nc - js < slice) ? nc - js : slice) : 0;
+
+            for(size_t pc = 0; pc < K; pc += GEMM_KC)
+            {
+                size_t kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+
+                #pragma omp for schedule(static)
+                for(size_t q = 0; q < nc; q += GEMM_NR)
+                {
+                    size_t nr = (nc - q < GEMM_NR) ? nc - q : GEMM_NR;
+                    B->pack(B, pc, jc + q, kc, nr, packed_b->data + q * kc);
+                }
+
+                if(n_parts == 1) {
+                    for(size_t ic = row_begin; ic < row_end; ic += GEMM_MC)
+                    {
+                        size_t mc = (row_end - ic < GEMM_MC) ? row_end - ic : GEMM_MC;
+
+                        A->pack(A, ic, pc, mc, kc, a_panel);
+                        macro_kernel(mc, nc, kc, a_panel, packed_b->data, C + ic * ldc + jc, ldc);
+                    }
+                } else {
+                    for(size_t p = row_begin + part * GEMM_MR; p < row_end; p += parts * GEMM_MR)
+                    {
+                        size_t mr = (row_end - p < GEMM_MR) ? row_end - p : GEMM_MR;
+                        A->pack(A, p, pc, mr, kc, a_panel + (p - row_begin) * kc);
+                    }
+
+                    #pragma omp barrier
+
+                    for(size_t ic = row_begin; ns > 0 && ic < row_end; ic += GEMM_MC)
+                    {
+                        size_t mc = (row_end - ic < GEMM_MC) ? row_end - ic : GEMM_MC;
+                        macro_kernel(mc, ns, kc, a_panel + (ic - row_begin) * kc, packed_b->data + js * kc, C + ic * ldc + jc + js, ldc);
+                    }
+                }
+
+                // packed_b and the group panels are rewritten on the next pass
+                #pragma omp barrier
+            }
+        }
+    }
+
+    return 0;
+}
+
+int matrix_multiply_packed(const Matrix *matA, int transA, const Matrix *matB, int transB, Matrix *res, int accumulate)
+{
+    if(matA == NULL || matB == NULL || res == NULL) return 1;
+
+    size_t M = transA ? matA->cols : matA->rows;
+    size_t K = transA ? matA->rows : matA->cols;
+    size_t KB = transB ? matB->cols : matB->rows;
+    size_t N = transB ? matB->rows : matB->cols;
+
+    if(K != KB || res->rows != M || res->cols != N) return 2;
+
+    gemm_src_t A = gemm_src_a(matA->data, matA->cols, transA);
+    gemm_src_t B = gemm_src_b(matB->data, matB->cols, transB);
+
+    return gemm_packed(M, N, K, &A, &B, res->data, res->cols, accumulate);
+}
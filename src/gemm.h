@@ -0,0 +1,44 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdlib.h>
+#include "half.h"
+#include "matrix.h"
+
+/* Blocking Parameters */
+#define GEMM_MR 4
+#define GEMM_NR 8
+#define GEMM_MC 128
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+typedef struct gemm_src gemm_src_t;
+
+/*
+ * Packs the block [row0, row0 + rows) x [col0, col0 + cols) of a logical operand.
+ * A-side packers write GEMM_MR-row micro-panels (k-major inside each panel), B-side
+ * packers write GEMM_NR-column micro-panels. Ragged edges are zero-padded.
+ */
+typedef void (*gemm_pack_fn)(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel);
+
+struct gemm_src {
+    const void *data;
+    size_t ld;
+    int trans;
+    const void *ctx;
+    gemm_pack_fn pack;
+};
+
+/* Operand Sources */
+gemm_src_t gemm_src_a(const double *data, size_t ld, int trans);
+gemm_src_t gemm_src_b(const double *data, size_t ld, int trans);
+gemm_src_t gemm_src_b_reduced(const uint16_t *data, size_t ld, int trans, precision_t format);
+void gemm_pack_a(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel);
+void gemm_pack_b(const gemm_src_t *src, size_t row0, size_t col0, size_t rows, size_t cols, double *panel);
+
+/* Multiplication */
+int gemm_packed(size_t M, size_t N, size_t K, const gemm_src_t *A, const gemm_src_t *B, double *C, size_t ldc, int accumulate);
+int matrix_multiply_packed(const Matrix *A, int transA, const Matrix *B, int transB, Matrix *res, int accumulate);
+void gemm_release_workspace(void);
+
+#endif // GEMM_H
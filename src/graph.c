@@ -0,0 +1,253 @@
+#include "graph.h"
+#include <string.h>
+
+static int op_forward(gGraph_t *graph, gOp_t *op)
+{
+    (void)graph;
+    return layer_forward_cached(op->layer, op->input, op->linear_output, op->output);
+}
+
+// Mean squared error over the batch; writes dL/d(output) into op->grad_input
+static int op_mse_grad(gGraph_t *graph, gOp_t *op)
+{
+    const Matrix *predicted = op->input;
+    const Matrix *target = &graph->target_view;
+    Matrix *grad = op->grad_input;
+
+    size_t n = predicted->rows * predicted->cols;
+    double scale = 2.0 / (double)n;
+    double loss = 0.0;
+
+    #pragma omp parallel for simd schedule(static) reduction(+:loss)
+    for(size_t i = 0; i < n; i++)
+    {
+        double diff = predicted->data[i] - target->data[i];
+        loss += diff * diff;
+        grad->data[i] = scale * diff;
+    }
+
+    graph->loss = loss / (double)n;
+    return 0;
+}
+
+static int op_backward(gGraph_t *graph, gOp_t *op)
+{
+    int ret = layer_backward_workspace(op->layer, op->input, op->linear_output, op->grad_output, op->delta,
+                                       op->grad_input, op->grad_weights, op->grad_biases);
+
+    if(!ret && graph->on_gradient) graph->on_gradient(graph, op, graph->on_gradient_ctx);
+
+    return ret;
+}
+
+static int op_update(gGraph_t *graph, gOp_t *op)
+{
+    return layer_update(op->layer, op->grad_weights, op->grad_biases, graph->learning_rate);
+}
+
+static int replay(gGraph_t *graph, size_t begin, size_t end)
+{
+    int ret;
+    for(size_t i = begin; i < end; i++)
+    {
+        gOp_t *op = &graph->schedule[i];
+        ret = op->kernel(graph, op);
+        if(ret) return ret;
+    }
+
+    return 0;
+}
+
+gGraph_t* graph_capture(NeuralNetwork *nn, size_t batch_size)
+{
+    if(nn == NULL || nn->num_layers == 0 || batch_size == 0) return NULL;
+
+    gGraph_t *graph = (gGraph_t *)calloc(1, sizeof(gGraph_t));
+    if(graph == NULL) return NULL;
+
+    size_t L = nn->num_layers;
+    graph->nn = nn;
+    graph->batch_size = batch_size;
+
+    graph->activations = (Matrix **)calloc(L + 1, sizeof(Matrix *));
+    graph->grad_activations = (Matrix **)calloc(L + 1, sizeof(Matrix *));
+    graph->linear_outputs = (Matrix **)calloc(L, sizeof(Matrix *));
+    graph->deltas = (Matrix **)calloc(L, sizeof(Matrix *));
+    graph->grad_weights = (Matrix **)calloc(L, sizeof(Matrix *));
+    graph->grad_biases = (Matrix **)calloc(L, sizeof(Matrix *));
+
+    // Forward, loss, backward and update ops laid out in execution order
+    graph->num_ops = 3 * L + 1;
+    graph->forward_end = L;
+    graph->backward_end = 2 * L + 1;
+    graph->schedule = (gOp_t *)calloc(graph->num_ops, sizeof(gOp_t));
+
+    if(graph->activations == NULL || graph->grad_activations == NULL || graph->linear_outputs == NULL ||
+       graph->deltas == NULL || graph->grad_weights == NULL || graph->grad_biases == NULL || graph->schedule == NULL) {
+        free_graph(graph);
+        return NULL;
+    }
+
+    // The caller's input and target are bound into these views on every replay, without copying
+    graph->input_view.rows = batch_size;
+    graph->input_view.cols = nn->layers[0].input_dim;
+    graph->target_view.rows = batch_size;
+    graph->target_view.cols = nn->layers[L - 1].output_dim;
+    graph->activations[0] = &graph->input_view;
+
+    for(size_t i = 0; i < L; i++)
+    {
+        Layer *layer = &nn->layers[i];
+
+        graph->activations[i + 1] = initialise_matrix(batch_size, layer->output_dim);
+        graph->grad_activations[i + 1] = initialise_matrix(batch_size, layer->output_dim);
+        graph->linear_outputs[i] = initialise_matrix(batch_size, layer->output_dim);
+        graph->deltas[i] = initialise_matrix(batch_size, layer->output_dim);
+        graph->grad_weights[i] = initialise_matrix(layer->weights->rows, layer->weights->cols);
+        graph->grad_biases[i] = initialise_matrix(layer->biases->rows, layer->biases->cols);
+
+        if(graph->activations[i + 1] == NULL || graph->grad_activations[i + 1] == NULL || graph->linear_outputs[i] == NULL ||
+           graph->deltas[i] == NULL || graph->grad_weights[i] == NULL || graph->grad_biases[i] == NULL) {
+            free_graph(graph);
+            return NULL;
+        }
+    }
+
+    gOp_t *op = graph->schedule;
+
+    for(size_t i = 0; i < L; i++, op++)
+    {
+        op->kernel = op_forward;
+        op->layer = &nn->layers[i];
+        op->input = graph->activations[i];
+        op->linear_output = graph->linear_outputs[i];
+        op->output = graph->activations[i + 1];
+    }
+
+    op->kernel = op_mse_grad;
+    op->input = graph->activations[L];
+    op->grad_input = graph->grad_activations[L];
+    op++;
+
+    for(size_t i = L; i-- > 0; op++)
+    {
+        op->kernel = op_backward;
+        op->layer = &nn->layers[i];
+        op->input = graph->activations[i];
+        op->linear_output = graph->linear_outputs[i];
+        op->grad_output = graph->grad_activations[i + 1];
+        op->delta = graph->deltas[i];
+        op->grad_input = graph->grad_activations[i];
+        op->grad_weights = graph->grad_weights[i];
+        op->grad_biases = graph->grad_biases[i];
+    }
+
+    for(size_t i = 0; i < L; i++, op++)
+    {
+        op->kernel = op_update;
+        op->layer = &nn->layers[i];
+        op->grad_weights = graph->grad_weights[i];
+        op->grad_biases = graph->grad_biases[i];
+    }
+
+    return graph;
+}
+
+void free_graph(gGraph_t *graph)
+{
+    if(graph == NULL) return;
+
+    size_t L = graph->nn->num_layers;
+
+    for(size_t i = 0; i < L; i++)
+    {
+        if(graph->activations) free_matrix(graph->activations[i + 1]);
+        if(graph->grad_activations) free_matrix(graph->grad_activations[i + 1]);
+        if(graph->linear_outputs) free_matrix(graph->linear_outputs[i]);
+        if(graph->deltas) free_matrix(graph->deltas[i]);
+        if(graph->grad_weights) free_matrix(graph->grad_weights[i]);
+        if(graph->grad_biases) free_matrix(graph->grad_biases[i]);
+    }
+
+    free(graph->activations);
+    free(graph->grad_activations);
+    free(graph->linear_outputs);
+    free(graph->deltas);
+    free(graph->grad_weights);
+    free(graph->grad_biases);
+    free(graph->schedule);
+    free(graph);
+}
+
+static int bind_input(gGraph_t *graph, const Matrix *input)
+{
+    if(input == NULL) return 1;
+    if(input->rows != graph->input_view.rows || input->cols != graph->input_view.cols) return 2;
+
+    graph->input_view.data = input->data;
+    return 0;
+}
+
+static int bind_target(gGraph_t *graph, const Matrix *target)
+{
+    if(target == NULL) return 1;
+    if(target->rows != graph->target_view.rows || target->cols != graph->target_view.cols) return 2;
+
+    graph->target_view.data = target->data;
+    return 0;
+}
+
+int graph_forward(gGraph_t *graph, const Matrix *input, Matrix *output)
+{
+    if(graph == NULL) return 1;
+
+    int ret = bind_input(graph, input);
+    if(ret) return ret;
+
+    ret = replay(graph, 0, graph->forward_end);
+    if(ret || output == NULL) return ret;
+
+    const Matrix *result = graph->activations[graph->nn->num_layers];
+    if(output->rows != result->rows || output->cols != result->cols) return 2;
+
+    memcpy(output->data, result->data, result->rows * result->cols * sizeof(double));
+    return 0;
+}
+
+// Loss gradient and backward pass for the most recent graph_forward; leaves weights untouched
+int graph_backward(gGraph_t *graph, const Matrix *target)
+{
+    if(graph == NULL) return 1;
+    if(graph->input_view.data == NULL) return 3;
+
+    int ret = bind_target(graph, target);
+    if(ret) return ret;
+
+    return replay(graph, graph->forward_end, graph->backward_end);
+}
+
+int graph_update(gGraph_t *graph, double learning_rate)
+{
+    if(graph == NULL) return 1;
+
+    graph->learning_rate = learning_rate;
+    return replay(graph, graph->backward_end, graph->num_ops);
+}
+
+int graph_train_step(gGraph_t *graph, const Matrix *input, const Matrix *target, double learning_rate, double *loss)
+{
+    if(graph == NULL) return 1;
+
+    int ret = bind_input(graph, input);
+    if(ret) return ret;
+
+    ret = bind_target(graph, target);
+    if(ret) return ret;
+
+    graph->learning_rate = learning_rate;
+
+    ret = replay(graph, 0, graph->num_ops);
+    if(loss) *loss = graph->loss;
+
+    return ret;
+}
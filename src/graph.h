@@ -0,0 +1,64 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "neural_net.h"
+
+/*
+ * Captured training step for a fixed NeuralNetwork and batch size. Capture records
+ * every kernel call with its shapes and bound buffers once; replay walks the flat
+ * schedule with no graph construction, sorting or allocation. GEMM pack and Winograd
+ * transform scratch is cached per thread, so only the first replay on a thread grows it.
+ */
+
+typedef struct gGraph gGraph_t;
+typedef struct gOp gOp_t;
+
+struct gOp {
+    int (*kernel)(gGraph_t *graph, gOp_t *op);
+    Layer *layer;
+    Matrix *input;
+    Matrix *linear_output;
+    Matrix *output;
+    Matrix *grad_output;
+    Matrix *delta;
+    Matrix *grad_input;
+    Matrix *grad_weights;
+    Matrix *grad_biases;
+};
+
+struct gGraph {
+    NeuralNetwork *nn;
+    size_t batch_size;
+
+    Matrix input_view;
+    Matrix target_view;
+    Matrix **activations;
+    Matrix **linear_outputs;
+    Matrix **deltas;
+    Matrix **grad_activations;
+    Matrix **grad_weights;
+    Matrix **grad_biases;
+
+    gOp_t *schedule;
+    size_t num_ops;
+    size_t forward_end;
+    size_t backward_end;
+
+    double learning_rate;
+    double loss;
+
+    // Called after each layer's backward op, as soon as its gradients are final
+    void (*on_gradient)(gGraph_t *graph, gOp_t *op, void *ctx);
+    void *on_gradient_ctx;
+};
+
+gGraph_t* graph_capture(NeuralNetwork *nn, size_t batch_size);
+void free_graph(gGraph_t *graph);
+
+/* Replay */
+int graph_forward(gGraph_t *graph, const Matrix *input, Matrix *output);
+int graph_backward(gGraph_t *graph, const Matrix *target);
+int graph_update(gGraph_t *graph, double learning_rate);
+int graph_train_step(gGraph_t *graph, const Matrix *input, const Matrix *target, double learning_rate, double *loss);
+
+#endif // GRAPH_H
@@ -0,0 +1,156 @@
+#include "half.h"
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+static inline uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bits_float(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/*
+ * double -> float with round-to-odd. Narrowing that result again with round-to-nearest-even
+ * gives the same answer as rounding the double directly, as float keeps more than
+ * two extra bits over both bf16 and fp16. This avoids double-rounding errors on ties.
+ */
+static inline float narrow_to_float_odd(double x)
+{
+    float f = (float)x;
+    if(isnan(x) || (double)f == x) return f;
+
+    uint32_t u = float_bits(f);
+    if((u & 1) == 0) {
+        // f was rounded away from x onto an even value; step back towards x
+        if(fabs((double)f) > fabs(x)) u--;
+        else u++;
+    }
+
+    return bits_float(u);
+}
+
+static inline uint16_t float_to_bf16(float f)
+{
+    uint32_t u = float_bits(f);
+
+    if((u & 0x7FFFFFFF) > 0x7F800000) return (uint16_t)((u >> 16) | 0x0040);
+
+    u += 0x7FFF + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+static inline float float_from_fp16(uint16_t h)
+{
+#ifdef __F16C__
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+
+    if(exponent == 0) {
+        // Subnormal: mantissa * 2^-24 is exact in float
+        float v = (float)mantissa * 5.9604644775390625e-8f;
+        return bits_float(float_bits(v) | sign);
+    }
+    if(exponent == 31) return bits_float(sign | 0x7F800000 | (mantissa << 13));
+
+    return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+#endif
+}
+
+static inline uint16_t float_to_fp16(float f)
+{
+#ifdef __F16C__
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t u = float_bits(f);
+    uint32_t sign = (u >> 16) & 0x8000;
+    uint32_t absu = u & 0x7FFFFFFF;
+
+    if(absu >= 0x7F800000) return (uint16_t)(sign | (absu > 0x7F800000 ? 0x7E00 : 0x7C00));
+
+    // 65520 and above round to infinity
+    if(absu >= 0x477FF000) return (uint16_t)(sign | 0x7C00);
+
+    if(absu < 0x38800000) {
+        // Below 2^-14: scale so the fp16 subnormal unit is 1 and round in hardware
+        float v = bits_float(absu) * 16777216.0f;
+        return (uint16_t)(sign | (uint32_t)nearbyintf(v));
+    }
+
+    absu += 0xFFF + ((absu >> 13) & 1);
+    absu -= 112u << 23;
+    return (uint16_t)(sign | (absu >> 13));
+#endif
+}
+
+uint16_t double_to_bf16(double x)
+{
+    return float_to_bf16(narrow_to_float_odd(x));
+}
+
+double bf16_to_double(uint16_t h)
+{
+    return (double)bits_float((uint32_t)h << 16);
+}
+
+uint16_t double_to_fp16(double x)
+{
+    return float_to_fp16(narrow_to_float_odd(x));
+}
+
+double fp16_to_double(uint16_t h)
+{
+    return (double)float_from_fp16(h);
+}
+
+int narrow_array(const double *src, uint16_t *dst, size_t n, precision_t format)
+{
+    if(src == NULL || dst == NULL) return 1;
+
+    if(format == precision_bf16) {
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < n; i++) dst[i] = double_to_bf16(src[i]);
+    } else if(format == precision_fp16) {
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < n; i++) dst[i] = double_to_fp16(src[i]);
+    } else {
+        return 5;
+    }
+
+    return 0;
+}
+
+int widen_array(const uint16_t *src, double *dst, size_t n, precision_t format)
+{
+    if(src == NULL || dst == NULL) return 1;
+
+    size_t i = 0;
+
+    if(format == precision_bf16) {
+        for(; i < n; i++) dst[i] = bf16_to_double(src[i]);
+    } else if(format == precision_fp16) {
+#ifdef __F16C__
+        for(; i + 8 <= n; i += 8)
+        {
+            __m256 f = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i)));
+            _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+            _mm256_storeu_pd(dst + i + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+        }
+#endif
+        for(; i < n; i++) dst[i] = fp16_to_double(src[i]);
+    } else {
+        return 5;
+    }
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef enum    {
+    precision_fp64,
+    precision_bf16,
+    precision_fp16
+} precision_t;
+
+/* Scalar Conversions (round to nearest even) */
+uint16_t double_to_bf16(double x);
+double bf16_to_double(uint16_t h);
+uint16_t double_to_fp16(double x);
+double fp16_to_double(uint16_t h);
+
+/* Bulk Conversions */
+int narrow_array(const double *src, uint16_t *dst, size_t n, precision_t format);
+int widen_array(const uint16_t *src, double *dst, size_t n, precision_t format);
+
+#endif // HALF_H
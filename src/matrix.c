@@ -2,9 +2,67 @@
 #include <immintrin.h>
 #include <omp.h>
 #include <stdio.h>
+#include "affinity.h"
 #include "autograd.h"
+#include "rng.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define MATRIX_ALIGNMENT 32
+#define MATRIX_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Buffers from 2 MB up, and any buffer that needs its own pages (own_pages), are
+ * page-aligned and padded to whole pages, so page-granular calls such as madvise and
+ * mbind never reach into neighbouring heap objects. Reports the result in *owns_pages.
+ * Also used for buffers that are not matrices of doubles, e.g. narrow weight copies.
+ */
+void* matrix_alloc_buffer(size_t bytes, int own_pages, int *owns_pages)
+{
+#ifdef _WIN32
+    *owns_pages = 0;
+    return _aligned_malloc(bytes, MATRIX_ALIGNMENT);
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t align = MATRIX_ALIGNMENT;
+
+    if(bytes >= MATRIX_HUGEPAGE_SIZE) {
+        align = MATRIX_HUGEPAGE_SIZE;
+        own_pages = 1;
+    } else if(own_pages) {
+        align = page;
+    }
+
+    if(own_pages) bytes = (bytes + page - 1) & ~(page - 1);
+
+    void *ptr = NULL;
+    if(posix_memalign(&ptr, align, bytes > 0 ? bytes : align) != 0) return NULL;
 
-static Matrix* create_matrix(size_t rows, size_t cols)
+#ifdef MADV_HUGEPAGE
+    // Only whole huge pages inside the buffer; the tail stays on small pages
+    if(align == MATRIX_HUGEPAGE_SIZE) {
+        madvise(ptr, bytes & ~((size_t)MATRIX_HUGEPAGE_SIZE - 1), MADV_HUGEPAGE);
+    }
+#endif
+
+    *owns_pages = own_pages;
+    return ptr;
+#endif
+}
+
+void matrix_free_buffer(void *buffer)
+{
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+static Matrix* create_matrix(size_t rows, size_t cols, int own_pages)
 {
     Matrix* ptr = (Matrix *)malloc(sizeof(Matrix));
 
@@ -12,8 +70,9 @@ static Matrix* create_matrix(size_t rows, size_t cols)
 
     ptr->rows = rows;
     ptr->cols = cols;
+    ptr->gNode = NULL;
 
-    ptr->data = (double *)_aligned_malloc(rows * cols * sizeof(double), 32);
+    ptr->data = (double *)matrix_alloc_buffer(rows * cols * sizeof(double), own_pages, &ptr->owns_pages);
     if(ptr->data == NULL) 
     {   
         free(ptr);
@@ -25,15 +84,42 @@ static Matrix* create_matrix(size_t rows, size_t cols)
 
 Matrix* initialise_matrix(size_t rows, size_t cols)
 {
-    Matrix* mat = create_matrix(rows, cols);
+    Matrix* mat = create_matrix(rows, cols, 0);
+    if(mat == NULL) return NULL;
+
+    // First touch happens here, so pages land on the node of the thread that owns each row block
     fill_matrix(mat, 0);
 
     return mat;
 }
 
+// The buffer gets pages of its own, bound before the first touch; NULL if the binding fails
+Matrix* initialise_matrix_on_node(size_t rows, size_t cols, int node)
+{
+    Matrix* mat = create_matrix(rows, cols, 1);
+    if(mat == NULL) return NULL;
+
+    if(matrix_bind_node(mat, node)) {
+        free_matrix(mat);
+        return NULL;
+    }
+    fill_matrix(mat, 0);
+
+    return mat;
+}
+
+// Buffers sharing pages with other heap objects can't be bound without moving those too
+int matrix_bind_node(Matrix *matrix, int node)
+{
+    if(matrix == NULL) return 1;
+    if(!matrix->owns_pages) return 6;
+
+    return affinity_bind_memory(matrix->data, matrix->rows * matrix->cols * sizeof(double), node);
+}
+
 static Matrix* get_submatrix(const Matrix* matA, int row_start, int col_start, int size) 
 {
-    Matrix* sub = create_matrix(size, size);
+    Matrix* sub = create_matrix(size, size, 0);
 
     for (int i = 0; i < size; i++) {
         for (int j = 0; j < size; j++) {
@@ -46,7 +132,9 @@ static Matrix* get_submatrix(const Matrix* matA, int row_start, int col_start, i
 
 void free_matrix(Matrix *matrix)
 {
-    _aligned_free(matrix->data);
+    if(matrix == NULL) return;
+
+    matrix_free_buffer(matrix->data);
     free(matrix);
 }
 
@@ -152,23 +240,29 @@ int matrix_multiply_opt(const Matrix *matA, const Matrix *matB, Matrix *res)
     Matrix *matBT = initialise_matrix(matB->cols, matB->rows);
     matrix_transpose(matB, matBT);
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < matA->rows; i++) {
-        for (size_t j = 0; j < matBT->rows; j++) {
-            __m256d sum = _mm256_setzero_pd();
-            size_t k;
-            for (k = 0; k <= matA->cols - 4; k += 4) {
-                __m256d a = _mm256_loadu_pd(&matA->data[i * matA->cols + k]);
-                __m256d b = _mm256_loadu_pd(&matBT->data[j * matBT->cols + k]);
-                sum = _mm256_add_pd(sum, _mm256_mul_pd(a, b));
-            }
-
-            double partial_sum = reduce_add(sum);
-            for (; k < matA->cols; k++) {
-                partial_sum += matA->data[i * matA->cols + k] * matBT->data[j * matBT->cols + k]; // Do it the hard way for the remainder
+    // Same row partitioning as fill_matrix, so each thread writes node-local rows
+    #pragma omp parallel
+    {
+        size_t row_begin, row_end;
+        matrix_row_range(matA->rows, omp_get_thread_num(), omp_get_num_threads(), &row_begin, &row_end);
+
+        for (size_t i = row_begin; i < row_end; i++) {
+            for (size_t j = 0; j < matBT->rows; j++) {
+                __m256d sum = _mm256_setzero_pd();
+                size_t k;
+                for (k = 0; k <= matA->cols - 4; k += 4) {
+                    __m256d a = _mm256_loadu_pd(&matA->data[i * matA->cols + k]);
+                    __m256d b = _mm256_loadu_pd(&matBT->data[j * matBT->cols + k]);
+                    sum = _mm256_add_pd(sum, _mm256_mul_pd(a, b));
+                }
+
+                double partial_sum = reduce_add(sum);
+                for (; k < matA->cols; k++) {
+                    partial_sum += matA->data[i * matA->cols + k] * matBT->data[j * matBT->cols + k]; // Do it the hard way for the remainder
+                }
+
+                res->data[i * res->cols + j] = partial_sum;
             }
-
-            res->data[i * res->cols + j] = partial_sum;
         }
     }
 
@@ -193,6 +287,14 @@ int matrix_transpose(const Matrix *matrix, Matrix *res)
     return 0;
 }
 
+int random_initialize(Matrix *matrix, double lower_bound, double upper_bound)
+{
+    if(matrix == NULL) return 1;
+    if(lower_bound > upper_bound) return 2;
+
+    return rng_fill_uniform(matrix->data, matrix->rows * matrix->cols, rng_get_seed(), rng_next_stream(), lower_bound, upper_bound);
+}
+
 int matrix_broadcast(const Matrix *src, Matrix *dest)
 {
     if (src == NULL || dest == NULL) return 1;
@@ -233,11 +335,39 @@ static void combine_matrix(Matrix *C11, Matrix *C12, Matrix *C21, Matrix *C22, M
 
 }
 
+/*
+ * Contiguous share of rows for one of parts threads, the first rows % parts threads
+ * taking one extra row. This is the first-touch partition: kernels that write rows in
+ * parallel use it too, so each thread writes pages local to its node.
+ */
+void matrix_row_range(size_t rows, int part, int parts, size_t *begin, size_t *end)
+{
+    size_t share = rows / (size_t)parts;
+    size_t extra = rows % (size_t)parts;
+    size_t p = (size_t)part;
+
+    *begin = p * share + (p < extra ? p : extra);
+    *end = *begin + share + (p < extra ? 1 : 0);
+}
+
 void fill_matrix(Matrix *matrix, double val)
 {
-    for(size_t i = 0; i < matrix->rows * matrix->cols; i++)
+    if(matrix == NULL) return;
+
+    size_t cols = matrix->cols;
+
+    #pragma omp parallel
     {
-        matrix->data[i] = val;
+        size_t row_begin, row_end;
+        matrix_row_range(matrix->rows, omp_get_thread_num(), omp_get_num_threads(), &row_begin, &row_end);
+
+        for(size_t i = row_begin; i < row_end; i++)
+        {
+            for(size_t j = 0; j < cols; j++)
+            {
+                matrix->data[i * cols + j] = val;
+            }
+        }
     }
 }
 
@@ -9,9 +9,11 @@ typedef struct Matrix   {
     size_t cols;
     double *data;
     gNode_t *gNode;
+    int owns_pages;     // data covers whole pages that no other allocation shares
 }  Matrix;
 
 Matrix* initialise_matrix(size_t rows, size_t cols);
+Matrix* initialise_matrix_on_node(size_t rows, size_t cols, int node);
 void free_matrix(Matrix *matrix);
 
 /* Arithmetic Functions */
@@ -27,6 +29,10 @@ int random_initialize(Matrix *matrix, double lower_bound, double upper_bound);
 /* Utility Functions */
 void fill_matrix(Matrix* matrix, double val);
 void print_matrix(const Matrix* matrix);
+int matrix_bind_node(Matrix *matrix, int node);
+void matrix_row_range(size_t rows, int part, int parts, size_t *begin, size_t *end);
+void* matrix_alloc_buffer(size_t bytes, int own_pages, int *owns_pages);
+void matrix_free_buffer(void *buffer);
 
 
 #endif
\ No newline at end of file
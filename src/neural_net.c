@@ -1,5 +1,13 @@
 #include "neural_net.h"
+#include "affinity.h"
 #include "math.h"
+#include "rng.h"
+#include "gemm.h"
+#include <stdio.h>
+#include <string.h>
+
+static void free_layer_data(Layer *layer);
+static int uses_winograd(const Layer *layer);
 
 NeuralNetwork* create_neural_network(size_t num_layers, size_t *layer_dims, activation_t *activation_funcs) {
 
@@ -16,15 +24,47 @@ NeuralNetwork* create_neural_network(size_t num_layers, size_t *layer_dims, acti
     }
 
     for (size_t i = 0; i < nn->num_layers; i++) {
-        nn->layers[i] = *create_layer(layer_dims[i], layer_dims[i + 1], activation_funcs[i]);
-        if (nn->layers[i].weights == NULL || nn->layers[i].biases == NULL) {
+        Layer *layer = create_layer(layer_dims[i], layer_dims[i + 1], activation_funcs[i]);
+        if (layer == NULL) {
             for (size_t j = 0; j < i; j++) {
-                free_layer(&(nn->layers[j]));
+                free_layer_data(&(nn->layers[j]));
             }
             free(nn->layers);
             free(nn);
             return NULL;
         }
+
+        nn->layers[i] = *layer;
+        free(layer);
+    }
+
+    return nn;
+}
+
+NeuralNetwork* create_neural_network_from_layers(size_t num_layers, Layer **layers)
+{
+    if (num_layers == 0 || num_layers > 1000 || layers == NULL) return NULL;
+
+    for (size_t i = 0; i < num_layers; i++) {
+        if (layers[i] == NULL) return NULL;
+        if (i + 1 < num_layers && layers[i + 1] != NULL && layers[i]->output_dim != layers[i + 1]->input_dim) return NULL;
+    }
+
+    NeuralNetwork *nn = (NeuralNetwork *)malloc(sizeof(NeuralNetwork));
+    if (nn == NULL) return NULL;
+
+    nn->num_layers = num_layers;
+    nn->layers = (Layer *)malloc(sizeof(Layer) * num_layers);
+    if (nn->layers == NULL) {
+        free(nn);
+        return NULL;
+    }
+
+    // The network takes ownership of each layer's buffers
+    for (size_t i = 0; i < num_layers; i++) {
+        nn->layers[i] = *layers[i];
+        free(layers[i]);
+        layers[i] = NULL;
     }
 
     return nn;
@@ -36,7 +76,7 @@ void free_neural_network(NeuralNetwork *nn) {
     {
         for (size_t i = 0; i < nn->num_layers; i++) 
         {
-            free_layer(&(nn->layers[i]));
+            free_layer_data(&(nn->layers[i]));
         }
 
         free(nn->layers);
@@ -51,62 +91,414 @@ Layer* create_layer(size_t input_dim, size_t output_dim, activation_t activation
         return NULL;
     }
 
-    layer->weights = initialise_matrix(output_dim, input_dim);
-    if(layer->weights == NULL)  {
-        return NULL;
-    }
+    layer->type = dense;
+    layer->conv = NULL;
+    layer->weight_format = precision_fp64;
+    layer->weights_lp = NULL;
+    layer->node = -1;
+
+    layer->weights = initialise_matrix(input_dim, output_dim);
     layer->biases = initialise_matrix(output_dim, 1);
-    if(layer->biases == NULL)   {
+    if(layer->weights == NULL || layer->biases == NULL)  {
+        free_layer(layer);
         return NULL;
     }
 
-    initialise_weights(layer->weights);
-
     layer->input_dim = input_dim;
     layer->output_dim = output_dim;
     layer->activation_func = activation_func;
 
+    layer_initialise_weights(layer, xavier_uniform);
+
     return layer;
 }
 
-void free_layer(Layer *layer)
+Layer* create_conv_layer(size_t in_h, size_t in_w, size_t in_c, size_t out_c, size_t kernel, size_t stride, size_t padding, activation_t activation_func)
 {
-    if(layer == NULL) return;
+    Layer *layer = (Layer *)malloc(sizeof(Layer));
+    if (layer == NULL)  {
+        return NULL;
+    }
+
+    layer->type = conv2d;
+    layer->weights = NULL;
+    layer->biases = NULL;
+    layer->weight_format = precision_fp64;
+    layer->weights_lp = NULL;
+    layer->node = -1;
 
+    layer->conv = (ConvParams *)malloc(sizeof(ConvParams));
+    if(layer->conv == NULL || conv_params_init(layer->conv, in_h, in_w, in_c, out_c, kernel, stride, padding)) {
+        free_layer(layer);
+        return NULL;
+    }
+
+    // One bias per output channel, broadcast over every spatial position
+    layer->weights = initialise_matrix(kernel * kernel * in_c, out_c);
+    layer->biases = initialise_matrix(out_c, 1);
+    if(layer->weights == NULL || layer->biases == NULL)  {
+        free_layer(layer);
+        return NULL;
+    }
+
+    layer->input_dim = in_h * in_w * in_c;
+    layer->output_dim = layer->conv->out_h * layer->conv->out_w * out_c;
+    layer->activation_func = activation_func;
+
+    layer_initialise_weights(layer, xavier_uniform);
+
+    return layer;
+}
+
+static void free_layer_data(Layer *layer)
+{
     free_matrix(layer->weights);
     free_matrix(layer->biases);
+    free(layer->conv);
+    matrix_free_buffer(layer->weights_lp);
+}
+
+void free_layer(Layer *layer)
+{
+    if(layer == NULL) return;
+
+    free_layer_data(layer);
     free(layer);
 }
 
+// Bias j % len is added to column j, which covers both dense outputs and NHWC channels
+static void add_bias(Matrix *output, const Matrix *biases)
+{
+    size_t len = biases->rows;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < output->rows; i++)
+    {
+        for(size_t j = 0; j < output->cols; j++)
+        {
+            output->data[i * output->cols + j] += biases->data[j % len];
+        }
+    }
+}
+
+int layer_forward_cached(Layer *layer, const Matrix *input, Matrix *linear_output, Matrix *output)
+{
+    if(layer == NULL || input == NULL || linear_output == NULL || output == NULL) return 1;
+    if(input->cols != layer->input_dim) return 2;
+    if(linear_output->rows != input->rows || linear_output->cols != layer->output_dim) return 2;
+
+    if(layer->weight_format == precision_fp64 && layer->weights->data == NULL) return 6;
+
+    int ret;
+    if(layer->weight_format == precision_fp64 && uses_winograd(layer)) {
+        ret = conv2d_forward_winograd(layer->conv, input, layer->weights, linear_output);
+    } else if(layer->weight_format != precision_fp64) {
+        // Narrow weights are widened inside the GEMM packing, math stays in double
+        gemm_src_t B = gemm_src_b_reduced(layer->weights_lp, layer->weights->cols, 0, layer->weight_format);
+
+        if(layer->type == conv2d) {
+            ret = conv2d_forward_packed(layer->conv, input, &B, linear_output);
+        } else {
+            gemm_src_t A = gemm_src_a(input->data, input->cols, 0);
+            ret = gemm_packed(input->rows, layer->output_dim, input->cols, &A, &B, linear_output->data, linear_output->cols, 0);
+        }
+    } else if(layer->type == conv2d) {
+        ret = conv2d_forward(layer->conv, input, layer->weights, linear_output);
+    } else {
+        ret = matrix_multiply_packed(input, 0, layer->weights, 0, linear_output, 0);
+    }
+    if(ret) return ret;
+
+    add_bias(linear_output, layer->biases);
+
+    return activation(linear_output, output, layer->activation_func);
+}
+
 int layer_forward(Layer *layer, Matrix *input, Matrix *output)
 {
     if(layer == NULL || input == NULL || output == NULL) return 1;
-    if (input->cols != layer->weights->rows) return 2;
 
     Matrix *linear_output = initialise_matrix(input->rows, layer->output_dim);
     if(linear_output == NULL) return 4;
 
-    int ret = matrix_multiply_opt(input, layer->weights, linear_output);
-    if(ret) {
-        free_matrix(linear_output);
-        return ret;
+    int ret = layer_forward_cached(layer, input, linear_output, output);
+    free_matrix(linear_output);
+    return ret;
+}
+
+int layer_backward(Layer *layer, const Matrix *input, Matrix *linear_output, const Matrix *grad_output, Matrix *grad_input, Matrix *grad_weights, Matrix *grad_biases)
+{
+    if(layer == NULL || linear_output == NULL) return 1;
+
+    Matrix *delta = initialise_matrix(linear_output->rows, linear_output->cols);
+    if(delta == NULL) return 4;
+
+    int ret = layer_backward_workspace(layer, input, linear_output, grad_output, delta, grad_input, grad_weights, grad_biases);
+    free_matrix(delta);
+    return ret;
+}
+
+int layer_backward_workspace(Layer *layer, const Matrix *input, Matrix *linear_output, const Matrix *grad_output, Matrix *delta, Matrix *grad_input, Matrix *grad_weights, Matrix *grad_biases)
+{
+    if(layer == NULL || input == NULL || linear_output == NULL || grad_output == NULL || delta == NULL) return 1;
+    if(grad_weights == NULL || grad_biases == NULL) return 1;
+    if(grad_output->rows != linear_output->rows || grad_output->cols != linear_output->cols) return 2;
+    if(delta->rows != linear_output->rows || delta->cols != linear_output->cols) return 2;
+    if(grad_biases->rows != layer->biases->rows) return 2;
+    if(layer->weights->data == NULL) return 6;
+
+    int ret = dactivation(linear_output, delta, layer->activation_func);
+    if(ret) return ret;
+
+    size_t n = delta->rows * delta->cols;
+
+    #pragma omp parallel for simd schedule(static)
+    for(size_t i = 0; i < n; i++)
+    {
+        delta->data[i] *= grad_output->data[i];
     }
 
-    Matrix *bias_bd =  initialise_matrix(linear_output->rows, linear_output->cols);
-    ret = broadcast_matrix(layer->biases, bias_bd);
-    if(ret) {
-        free_matrix(linear_output);
-        return ret;
+    size_t len = grad_biases->rows;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t b = 0; b < len; b++)
+    {
+        double sum = 0.0;
+        for(size_t i = 0; i < delta->rows; i++)
+        {
+            for(size_t j = b; j < delta->cols; j += len)
+            {
+                sum += delta->data[i * delta->cols + j];
+            }
+        }
+        grad_biases->data[b] = sum;
     }
 
-    ret = matrix_add(linear_output, bias_bd, linear_output);
-    if(ret) {
-        free_matrix(linear_output);
-        return ret;
+    if(layer->type == conv2d) {
+        return conv2d_backward(layer->conv, input, layer->weights, delta, grad_input, grad_weights);
     }
-    
-    ret = activation(linear_output, output, layer->activation_func);
-    free_matrix(linear_output);
+
+    ret = matrix_multiply_packed(input, 1, delta, 0, grad_weights, 0);
+    if(ret || grad_input == NULL) return ret;
+
+    return matrix_multiply_packed(delta, 0, layer->weights, 1, grad_input, 0);
+}
+
+int layer_update(Layer *layer, const Matrix *grad_weights, const Matrix *grad_biases, double learning_rate)
+{
+    if(layer == NULL || grad_weights == NULL || grad_biases == NULL) return 1;
+    if(grad_weights->rows != layer->weights->rows || grad_weights->cols != layer->weights->cols) return 2;
+    if(grad_biases->rows != layer->biases->rows) return 2;
+    if(layer->weights->data == NULL) return 6;
+
+    size_t n = layer->weights->rows * layer->weights->cols;
+
+    #pragma omp parallel for simd schedule(static)
+    for(size_t i = 0; i < n; i++)
+    {
+        layer->weights->data[i] -= learning_rate * grad_weights->data[i];
+    }
+
+    for(size_t i = 0; i < layer->biases->rows; i++)
+    {
+        layer->biases->data[i] -= learning_rate * grad_biases->data[i];
+    }
+
+    // The fp64 weights stay the master copy; keep the narrow copy in sync
+    if(layer->weight_format != precision_fp64) {
+        return narrow_array(layer->weights->data, layer->weights_lp, n, layer->weight_format);
+    }
+
+    return 0;
+}
+
+// Winograd transforms the fp64 filters itself, so those layers have no narrow weight path
+static int uses_winograd(const Layer *layer)
+{
+    return layer->type == conv2d && layer->conv->winograd && conv_winograd_eligible(layer->conv);
+}
+
+int layer_set_weight_format(Layer *layer, precision_t format)
+{
+    if(layer == NULL) return 1;
+    if(layer->weights->data == NULL) return 6;
+
+    if(format == precision_fp64) {
+        matrix_free_buffer(layer->weights_lp);
+        layer->weights_lp = NULL;
+        layer->weight_format = precision_fp64;
+        return 0;
+    }
+
+    if(format != precision_bf16 && format != precision_fp16) return 5;
+    if(uses_winograd(layer)) return 6;
+
+    size_t n = layer->weights->rows * layer->weights->cols;
+
+    // Pages of its own, so a bound layer can place the copy before narrowing first-touches it
+    if(layer->weights_lp == NULL) {
+        int owns_pages;
+        layer->weights_lp = (uint16_t *)matrix_alloc_buffer(n * sizeof(uint16_t), 1, &owns_pages);
+        if(layer->weights_lp == NULL) return 4;
+
+        int ret = (layer->node >= 0) ? affinity_bind_memory(layer->weights_lp, n * sizeof(uint16_t), layer->node) : 0;
+        if(ret) {
+            matrix_free_buffer(layer->weights_lp);
+            layer->weights_lp = NULL;
+            return ret;
+        }
+    }
+
+    int ret = narrow_array(layer->weights->data, layer->weights_lp, n, format);
+    if(ret) return ret;
+
+    layer->weight_format = format;
+    return 0;
+}
+
+int layer_weight_error(const Layer *layer, double *max_abs_error, double *rms_error)
+{
+    if(layer == NULL || max_abs_error == NULL || rms_error == NULL) return 1;
+
+    *max_abs_error = 0.0;
+    *rms_error = 0.0;
+    if(layer->weight_format == precision_fp64) return 0;
+    if(layer->weights->data == NULL) return 6;
+
+    size_t n = layer->weights->rows * layer->weights->cols;
+    double max_err = 0.0, sum_sq = 0.0;
+
+    #pragma omp parallel for schedule(static) reduction(max:max_err) reduction(+:sum_sq)
+    for(size_t i = 0; i < n; i++)
+    {
+        uint16_t h = layer->weights_lp[i];
+        double w = (layer->weight_format == precision_bf16) ? bf16_to_double(h) : fp16_to_double(h);
+        double err = fabs(w - layer->weights->data[i]);
+
+        if(err > max_err) max_err = err;
+        sum_sq += err * err;
+    }
+
+    *max_abs_error = max_err;
+    *rms_error = n ? sqrt(sum_sq / (double)n) : 0.0;
+
+    return 0;
+}
+
+/*
+ * Drops the fp64 master copy of a layer that runs from narrow weights, for inference-only
+ * use. The weights matrix keeps its shape with NULL data; training, re-narrowing and
+ * precision reports need the master and return 6 from then on.
+ */
+int layer_release_master_weights(Layer *layer)
+{
+    if(layer == NULL) return 1;
+    if(layer->weight_format == precision_fp64) return 6;
+
+    matrix_free_buffer(layer->weights->data);
+    layer->weights->data = NULL;
+    layer->weights->owns_pages = 0;
+
+    return 0;
+}
+
+// Winograd layers keep fp64 weights, since they have no narrow path
+int nn_set_weight_format(NeuralNetwork *nn, precision_t format)
+{
+    if(nn == NULL) return 1;
+
+    int ret;
+    for(size_t i = 0; i < nn->num_layers; i++)
+    {
+        if(format != precision_fp64 && uses_winograd(&nn->layers[i])) continue;
+
+        ret = layer_set_weight_format(&nn->layers[i], format);
+        if(ret) return ret;
+    }
+
+    return 0;
+}
+
+// Narrow weights only, without fp64 masters; the network can then only run forward
+int nn_set_inference_weights(NeuralNetwork *nn, precision_t format)
+{
+    if(nn == NULL) return 1;
+    if(format != precision_bf16 && format != precision_fp16) return 5;
+
+    int ret = nn_set_weight_format(nn, format);
+    if(ret) return ret;
+
+    for(size_t i = 0; i < nn->num_layers; i++)
+    {
+        if(nn->layers[i].weight_format == precision_fp64) continue;
+
+        ret = layer_release_master_weights(&nn->layers[i]);
+        if(ret) return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Prints, per layer, the weight quantisation error and the error in that layer's output
+ * when it alone runs from narrow weights. Each layer sees the fp64 activations of the
+ * previous layer, so errors are reported in isolation rather than accumulated.
+ */
+int nn_precision_report(NeuralNetwork *nn, const Matrix *input)
+{
+    if(nn == NULL || input == NULL) return 1;
+
+    static const char *format_names[] = { "fp64", "bf16", "fp16" };
+
+    // The reference outputs come from the fp64 masters
+    for(size_t i = 0; i < nn->num_layers; i++)
+    {
+        if(nn->layers[i].weights->data == NULL) return 6;
+    }
+
+    Matrix *current = (Matrix *)input;
+    int ret = 0;
+
+    printf("%-6s %-6s %-14s %-14s %-14s\n", "layer", "format", "w_max_err", "w_rms_err", "out_max_err");
+
+    for(size_t i = 0; i < nn->num_layers && !ret; i++)
+    {
+        Layer *layer = &nn->layers[i];
+        precision_t format = layer->weight_format;
+
+        Matrix *reference = initialise_matrix(input->rows, layer->output_dim);
+        Matrix *reduced = initialise_matrix(input->rows, layer->output_dim);
+        if(reference == NULL || reduced == NULL) {
+            free_matrix(reference);
+            free_matrix(reduced);
+            ret = 4;
+            break;
+        }
+
+        ret = layer_forward(layer, current, reduced);
+
+        layer->weight_format = precision_fp64;
+        if(!ret) ret = layer_forward(layer, current, reference);
+        layer->weight_format = format;
+
+        double w_max = 0.0, w_rms = 0.0, out_max = 0.0;
+        if(!ret) ret = layer_weight_error(layer, &w_max, &w_rms);
+
+        for(size_t j = 0; j < reference->rows * reference->cols; j++)
+        {
+            double err = fabs(reference->data[j] - reduced->data[j]);
+            if(err > out_max) out_max = err;
+        }
+
+        printf("%-6zu %-6s %-14e %-14e %-14e\n", i, format_names[format], w_max, w_rms, out_max);
+
+        free_matrix(reduced);
+        if(current != input) free_matrix(current);
+        current = reference;
+    }
+
+    if(current != input) free_matrix(current);
+
     return ret;
 }
 
@@ -115,15 +507,29 @@ int nn_forward(NeuralNetwork *nn, Matrix *input, Matrix *output)
     if(nn == NULL || input == NULL || output == NULL) return 1;
 
     size_t num_layers = nn->num_layers;
+    if(output->rows != input->rows || output->cols != nn->layers[num_layers - 1].output_dim) return 2;
+
+    // Layers may change the activation width (e.g. convolutions), so intermediates are sized per layer
+    Matrix *current = input;
 
     int ret;
     for(size_t i = 0; i < num_layers; i++)
     {
-        ret = layer_forward(&nn->layers[i], input, output);
-        if(ret) return ret;
+        Matrix *next = (i == num_layers - 1) ? output : initialise_matrix(input->rows, nn->layers[i].output_dim);
+        if(next == NULL) {
+            if(current != input) free_matrix(current);
+            return 4;
+        }
+
+        ret = layer_forward(&nn->layers[i], current, next);
+
+        if(current != input) free_matrix(current);
+        if(ret) {
+            if(next != output) free_matrix(next);
+            return ret;
+        }
 
-        memcpy(input, output, sizeof(Matrix));
-        memcpy(input->data, output->data, input->rows * input->cols * sizeof(double));
+        current = next;
     }
 
     return 0;
@@ -157,11 +563,131 @@ static double dtanh(double x)   {
 
 int initialise_weights(Matrix *matrix) {
 
+    return initialise_weights_scheme(matrix, xavier_uniform);
+}
+
+static int fill_weights(Matrix *matrix, double fan_in, double fan_out, init_scheme_t scheme)
+{
+    size_t n = matrix->rows * matrix->cols;
+    double bound, stddev;
+
+    switch(scheme)
+    {
+        case xavier_uniform:
+            bound = sqrt(6.0 / (fan_in + fan_out));
+            return rng_fill_uniform(matrix->data, n, rng_get_seed(), rng_next_stream(), -bound, bound);
+        case xavier_normal:
+            stddev = sqrt(2.0 / (fan_in + fan_out));
+            return rng_fill_normal(matrix->data, n, rng_get_seed(), rng_next_stream(), 0.0, stddev);
+        case he_uniform:
+            bound = sqrt(6.0 / fan_in);
+            return rng_fill_uniform(matrix->data, n, rng_get_seed(), rng_next_stream(), -bound, bound);
+        case he_normal:
+            stddev = sqrt(2.0 / fan_in);
+            return rng_fill_normal(matrix->data, n, rng_get_seed(), rng_next_stream(), 0.0, stddev);
+        default:
+            return 5;
+    }
+}
+
+// For a bare matrix read as (fan_in x fan_out); layers should use layer_initialise_weights
+int initialise_weights_scheme(Matrix *matrix, init_scheme_t scheme)
+{
     if(matrix == NULL) return 1;
 
-    double stddev = 1.0 / sqrt(matrix->rows);
-    for (size_t i = 0; i < matrix->rows * matrix->cols; i++) {
-        matrix->data[i] = stddev * (2.0 * (rand() / (double)RAND_MAX) - 1.0); // Xavier method
+    return fill_weights(matrix, (double)matrix->rows, (double)matrix->cols, scheme);
+}
+
+// Fans come from the layer's shape, not from how its weight matrix happens to be stored
+int layer_initialise_weights(Layer *layer, init_scheme_t scheme)
+{
+    if(layer == NULL || layer->weights == NULL) return 1;
+
+    double fan_in, fan_out;
+    if(layer->type == conv2d) {
+        // Each output channel sees a kernel_h x kernel_w window, as in the usual Glorot/He fans
+        double window = (double)(layer->conv->kernel_h * layer->conv->kernel_w);
+        fan_in = window * (double)layer->conv->in_c;
+        fan_out = window * (double)layer->conv->out_c;
+    } else {
+        fan_in = (double)layer->input_dim;
+        fan_out = (double)layer->output_dim;
+    }
+
+    return fill_weights(layer->weights, fan_in, fan_out, scheme);
+}
+
+int dropout_mask(Matrix *mask, double drop_prob)
+{
+    if(mask == NULL) return 1;
+    if(drop_prob < 0.0 || drop_prob >= 1.0) return 2;
+
+    size_t n = mask->rows * mask->cols;
+    int ret = rng_fill_uniform(mask->data, n, rng_get_seed(), rng_next_stream(), 0.0, 1.0);
+    if(ret) return ret;
+
+    // Inverted dropout: kept units are rescaled so inference needs no correction
+    double keep_scale = 1.0 / (1.0 - drop_prob);
+
+    #pragma omp parallel for simd schedule(static)
+    for(size_t i = 0; i < n; i++)
+    {
+        mask->data[i] = (mask->data[i] >= drop_prob) ? keep_scale : 0.0;
+    }
+
+    return 0;
+}
+
+/*
+ * Small parameters share heap pages with other objects, so they are copied to a buffer of
+ * their own, bound before the copy touches it. A refused binding returns the same code
+ * either way.
+ */
+static int bind_parameter(Matrix *matrix, int node)
+{
+    int ret = matrix_bind_node(matrix, node);
+    if(ret != 6) return ret;
+
+    size_t bytes = matrix->rows * matrix->cols * sizeof(double);
+    int owns_pages;
+    double *data = (double *)matrix_alloc_buffer(bytes, 1, &owns_pages);
+    if(data == NULL) return 4;
+
+    ret = affinity_bind_memory(data, bytes, node);
+    if(ret) {
+        matrix_free_buffer(data);
+        return ret;
+    }
+
+    memcpy(data, matrix->data, bytes);
+    matrix_free_buffer(matrix->data);
+    matrix->data = data;
+    matrix->owns_pages = owns_pages;
+
+    return 0;
+}
+
+int nn_bind_weights(NeuralNetwork *nn, int node)
+{
+    if(nn == NULL) return 1;
+
+    int ret;
+    for(size_t i = 0; i < nn->num_layers; i++)
+    {
+        Layer *layer = &nn->layers[i];
+
+        ret = (layer->weights->data != NULL) ? bind_parameter(layer->weights, node) : 0;
+        if(ret) return ret;
+
+        ret = bind_parameter(layer->biases, node);
+        if(ret) return ret;
+
+        if(layer->weights_lp != NULL) {
+            ret = affinity_bind_memory(layer->weights_lp, layer->weights->rows * layer->weights->cols * sizeof(uint16_t), node);
+            if(ret) return ret;
+        }
+
+        layer->node = node;
     }
 
     return 0;
@@ -2,6 +2,8 @@
 #define NEURAL_NET_H
 
 #include "matrix.h"
+#include "conv.h"
+#include "half.h"
 
 typedef enum    {
     sigmoid, 
@@ -9,12 +11,29 @@ typedef enum    {
     tanh
 } activation_t;
 
+typedef enum    {
+    xavier_uniform,
+    xavier_normal,
+    he_uniform,
+    he_normal
+} init_scheme_t;
+
+typedef enum    {
+    dense,
+    conv2d
+} layer_type_t;
+
 typedef struct  {
+    layer_type_t type;
     size_t input_dim;
     size_t output_dim;
     Matrix *weights;
     Matrix *biases;
     activation_t activation_func;
+    ConvParams *conv;
+    precision_t weight_format;
+    uint16_t *weights_lp;
+    int node;               // NUMA node the parameters are bound to, -1 if unbound
 } Layer;
 
 typedef struct  {
@@ -32,11 +51,16 @@ int dactivation(Matrix *input, Matrix *output, activation_t activation_func);
 
 /* Layer Operations */
 Layer* create_layer(size_t input_dim, size_t output_dim, activation_t activation_func);
+Layer* create_conv_layer(size_t in_h, size_t in_w, size_t in_c, size_t out_c, size_t kernel, size_t stride, size_t padding, activation_t activation_func);
 void free_layer(Layer *layer);
 int layer_forward(Layer *layer, Matrix *input, Matrix *output);
+int layer_forward_cached(Layer *layer, const Matrix *input, Matrix *linear_output, Matrix *output);
+int layer_backward(Layer *layer, const Matrix *input, Matrix *linear_output, const Matrix *grad_output, Matrix *grad_input, Matrix *grad_weights, Matrix *grad_biases);
+int layer_backward_workspace(Layer *layer, const Matrix *input, Matrix *linear_output, const Matrix *grad_output, Matrix *delta, Matrix *grad_input, Matrix *grad_weights, Matrix *grad_biases);
 
 /* Neural Network Operations */
 NeuralNetwork* create_neural_network(size_t num_layers, size_t *layer_dims, activation_t *activation_funcs);
+NeuralNetwork* create_neural_network_from_layers(size_t num_layers, Layer **layers);
 void free_neural_network(NeuralNetwork *nn);
 int nn_forward(NeuralNetwork *nn, Matrix *input, Matrix *output);
 
@@ -47,8 +71,21 @@ double vae_loss(Matrix *predicted, Matrix *target);
 
 /* Training Functions */
 void update_weights(NeuralNetwork *nn, Matrix *gradient, double learning_rate);
+int layer_update(Layer *layer, const Matrix *grad_weights, const Matrix *grad_biases, double learning_rate);
+int dropout_mask(Matrix *mask, double drop_prob);
+
+/* Reduced Precision */
+int layer_set_weight_format(Layer *layer, precision_t format);
+int layer_weight_error(const Layer *layer, double *max_abs_error, double *rms_error);
+int layer_release_master_weights(Layer *layer);
+int nn_set_weight_format(NeuralNetwork *nn, precision_t format);
+int nn_set_inference_weights(NeuralNetwork *nn, precision_t format);
+int nn_precision_report(NeuralNetwork *nn, const Matrix *input);
 
 /* Utility Functions */
 int initialise_weights(Matrix *matrix);
+int initialise_weights_scheme(Matrix *matrix, init_scheme_t scheme);
+int layer_initialise_weights(Layer *layer, init_scheme_t scheme);
+int nn_bind_weights(NeuralNetwork *nn, int node);
 
 #endif
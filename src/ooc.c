@@ -0,0 +1,583 @@
+#include "ooc.h"
+#include "gemm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <omp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define OOC_MAGIC 0x4D54414D434F4FULL
+
+typedef struct  {
+    uint64_t magic;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t tile;
+} ooc_header_t;
+
+static size_t tile_bytes(const OocMatrix *matrix)
+{
+    return matrix->tile * matrix->tile * sizeof(double);
+}
+
+static off_t tile_offset(const OocMatrix *matrix, size_t ti, size_t tj)
+{
+    return (off_t)OOC_HEADER_BYTES + (off_t)((ti * matrix->tile_cols + tj) * tile_bytes(matrix));
+}
+
+// Drops a tile from the page cache once the caller has no further use for it
+static void drop_tile(const OocMatrix *matrix, size_t ti, size_t tj)
+{
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(matrix->fd, tile_offset(matrix, ti, tj), (off_t)tile_bytes(matrix), POSIX_FADV_DONTNEED);
+#else
+    (void)matrix;
+    (void)ti;
+    (void)tj;
+#endif
+}
+
+static int pread_full(int fd, void *buf, size_t bytes, off_t offset)
+{
+    char *p = (char *)buf;
+
+    while(bytes > 0)
+    {
+        ssize_t n = pread(fd, p, bytes, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return 3;
+
+        p += n;
+        offset += n;
+        bytes -= (size_t)n;
+    }
+
+    return 0;
+}
+
+static int pwrite_full(int fd, const void *buf, size_t bytes, off_t offset)
+{
+    const char *p = (const char *)buf;
+
+    while(bytes > 0)
+    {
+        ssize_t n = pwrite(fd, p, bytes, offset);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return 3;
+
+        p += n;
+        offset += n;
+        bytes -= (size_t)n;
+    }
+
+    return 0;
+}
+
+static OocMatrix* new_ooc_matrix(int fd, int writable, size_t rows, size_t cols, size_t tile)
+{
+    OocMatrix *matrix = (OocMatrix *)malloc(sizeof(OocMatrix));
+    if(matrix == NULL) return NULL;
+
+    matrix->fd = fd;
+    matrix->writable = writable;
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->tile = tile;
+    matrix->tile_rows = (rows + tile - 1) / tile;
+    matrix->tile_cols = (cols + tile - 1) / tile;
+
+    return matrix;
+}
+
+// New file with every tile zero; the body is left sparse until tiles are written
+OocMatrix* ooc_create(const char *path, size_t rows, size_t cols, size_t tile)
+{
+    if(path == NULL || rows == 0 || cols == 0 || tile == 0) return NULL;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return NULL;
+
+    OocMatrix *matrix = new_ooc_matrix(fd, 1, rows, cols, tile);
+    if(matrix == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    char header[OOC_HEADER_BYTES] = {0};
+    ooc_header_t h = { OOC_MAGIC, rows, cols, tile };
+    memcpy(header, &h, sizeof(h));
+
+    off_t size = tile_offset(matrix, matrix->tile_rows, 0);
+    if(pwrite_full(fd, header, sizeof(header), 0) || ftruncate(fd, size)) {
+        ooc_close(matrix);
+        return NULL;
+    }
+
+    return matrix;
+}
+
+OocMatrix* ooc_open(const char *path, int writable)
+{
+    if(path == NULL) return NULL;
+
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if(fd < 0) return NULL;
+
+    ooc_header_t h;
+    if(pread_full(fd, &h, sizeof(h), 0) || h.magic != OOC_MAGIC || h.rows == 0 || h.cols == 0 || h.tile == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    OocMatrix *matrix = new_ooc_matrix(fd, writable, h.rows, h.cols, h.tile);
+    if(matrix == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size < tile_offset(matrix, matrix->tile_rows, 0)) {
+        ooc_close(matrix);
+        return NULL;
+    }
+
+    return matrix;
+}
+
+void ooc_close(OocMatrix *matrix)
+{
+    if(matrix == NULL) return;
+
+    close(matrix->fd);
+    free(matrix);
+}
+
+int ooc_read_tile(const OocMatrix *matrix, size_t ti, size_t tj, Matrix *tile)
+{
+    if(matrix == NULL || tile == NULL) return 1;
+    if(ti >= matrix->tile_rows || tj >= matrix->tile_cols) return 2;
+    if(tile->rows != matrix->tile || tile->cols != matrix->tile) return 2;
+
+    return pread_full(matrix->fd, tile->data, tile_bytes(matrix), tile_offset(matrix, ti, tj));
+}
+
+// Writes a whole tile; entries past the matrix edge must be zero
+int ooc_write_tile(OocMatrix *matrix, size_t ti, size_t tj, const Matrix *tile)
+{
+    if(matrix == NULL || tile == NULL) return 1;
+    if(!matrix->writable) return 3;
+    if(ti >= matrix->tile_rows || tj >= matrix->tile_cols) return 2;
+    if(tile->rows != matrix->tile || tile->cols != matrix->tile) return 2;
+
+    return pwrite_full(matrix->fd, tile->data, tile_bytes(matrix), tile_offset(matrix, ti, tj));
+}
+
+int ooc_store(OocMatrix *dst, const Matrix *src)
+{
+    if(dst == NULL || src == NULL) return 1;
+    if(dst->rows != src->rows || dst->cols != src->cols) return 2;
+
+    size_t t = dst->tile;
+    Matrix *tile = initialise_matrix(t, t);
+    if(tile == NULL) return 4;
+
+    int ret = 0;
+    for(size_t ti = 0; ti < dst->tile_rows && !ret; ti++)
+    {
+        for(size_t tj = 0; tj < dst->tile_cols && !ret; tj++)
+        {
+            size_t m = (src->rows - ti * t < t) ? src->rows - ti * t : t;
+            size_t n = (src->cols - tj * t < t) ? src->cols - tj * t : t;
+
+            if(m < t || n < t) fill_matrix(tile, 0.0);
+            for(size_t i = 0; i < m; i++)
+            {
+                memcpy(tile->data + i * t, src->data + (ti * t + i) * src->cols + tj * t, n * sizeof(double));
+            }
+
+            ret = ooc_write_tile(dst, ti, tj, tile);
+        }
+    }
+
+    free_matrix(tile);
+
+    return ret;
+}
+
+int ooc_load(const OocMatrix *src, Matrix *dst)
+{
+    if(dst == NULL || src == NULL) return 1;
+    if(dst->rows != src->rows || dst->cols != src->cols) return 2;
+
+    size_t t = src->tile;
+    Matrix *tile = initialise_matrix(t, t);
+    if(tile == NULL) return 4;
+
+    int ret = 0;
+    for(size_t ti = 0; ti < src->tile_rows && !ret; ti++)
+    {
+        for(size_t tj = 0; tj < src->tile_cols && !ret; tj++)
+        {
+            size_t m = (dst->rows - ti * t < t) ? dst->rows - ti * t : t;
+            size_t n = (dst->cols - tj * t < t) ? dst->cols - tj * t : t;
+
+            ret = ooc_read_tile(src, ti, tj, tile);
+            for(size_t i = 0; i < m && !ret; i++)
+            {
+                memcpy(dst->data + (ti * t + i) * dst->cols + tj * t, tile->data + i * t, n * sizeof(double));
+            }
+        }
+    }
+
+    free_matrix(tile);
+
+    return ret;
+}
+
+/* Multiplication */
+
+// One step of the schedule: the operand tiles for C(i, j) += A(i, k) * B(k, j); a is unused while A's panel is resident
+typedef struct  {
+    Matrix *a;
+    Matrix *b;
+} ooc_slot_t;
+
+typedef struct  {
+    const OocMatrix *A;
+    const OocMatrix *B;
+    OocMatrix *C;
+
+    ooc_slot_t *slots;
+    Matrix **panel;         // A(i, 0..tk-1) for the last panel_rows rows i, or NULL to stream A
+    size_t panel_rows;
+    size_t depth;
+    size_t total;
+    size_t loaded;
+    size_t consumed;
+
+    // Finished C tiles are double-buffered so write-back overlaps the next tile
+    Matrix *c_tiles[2];
+    size_t c_index[2];
+    int c_pending[2];
+
+    int finished;
+    int abort;
+    int status;
+    OocStats *stats;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} ooc_job_t;
+
+static void step_tiles(const ooc_job_t *job, size_t n, size_t *i, size_t *j, size_t *k)
+{
+    size_t tk = job->A->tile_cols;
+    size_t tn = job->B->tile_cols;
+
+    *k = n % tk;
+    *j = (n / tk) % tn;
+    *i = n / (tk * tn);
+}
+
+// A row's panel is loaded by its j == 0 steps into the buffer of row i - panel_rows, once that row is done
+static int step_ready(const ooc_job_t *job, size_t n)
+{
+    if(job->panel == NULL) return 1;
+
+    size_t i, j, k;
+    step_tiles(job, n, &i, &j, &k);
+    if(j > 0 || i < job->panel_rows) return 1;
+
+    return job->consumed >= (i - job->panel_rows + 1) * job->B->tile_cols * job->A->tile_cols;
+}
+
+static Matrix* a_tile(const ooc_job_t *job, size_t n, size_t i, size_t k)
+{
+    if(job->panel) return job->panel[(i % job->panel_rows) * job->A->tile_cols + k];
+
+    return job->slots[n % job->depth].a;
+}
+
+/*
+ * Reader thread. Keeps up to depth steps of operand tiles loaded ahead of the compute
+ * thread and writes finished C tiles back, giving writes priority so their buffers
+ * return to the compute thread first. Tiles leave the page cache after their last use.
+ */
+static void* ooc_io_thread(void *arg)
+{
+    ooc_job_t *job = (ooc_job_t *)arg;
+    OocStats *stats = job->stats;
+    size_t n = 0;
+
+    pthread_mutex_lock(&job->lock);
+    while(!job->abort)
+    {
+        int w = job->c_pending[0] ? 0 : (job->c_pending[1] ? 1 : -1);
+
+        if(w >= 0) {
+            size_t index = job->c_index[w];
+            pthread_mutex_unlock(&job->lock);
+
+            double start = omp_get_wtime();
+            int ret = ooc_write_tile(job->C, index / job->C->tile_cols, index % job->C->tile_cols, job->c_tiles[w]);
+            stats->io_seconds += omp_get_wtime() - start;
+            stats->tiles_written++;
+            stats->bytes_written += tile_bytes(job->C);
+
+            if(!ret) drop_tile(job->C, index / job->C->tile_cols, index % job->C->tile_cols);
+
+            pthread_mutex_lock(&job->lock);
+            job->c_pending[w] = 0;
+            if(ret) {
+                job->status = ret;
+                job->abort = 1;
+            }
+            pthread_cond_broadcast(&job->cond);
+            continue;
+        }
+
+        if(n < job->total && n - job->consumed < job->depth && step_ready(job, n)) {
+            ooc_slot_t *slot = &job->slots[n % job->depth];
+            size_t i, j, k;
+            step_tiles(job, n, &i, &j, &k);
+            pthread_mutex_unlock(&job->lock);
+
+            // A resident panel is read once per row, on the row's first column of C
+            int read_a = (job->panel == NULL || j == 0);
+            int last_a = (job->panel != NULL || j == job->B->tile_cols - 1);
+
+            double start = omp_get_wtime();
+            int ret = read_a ? ooc_read_tile(job->A, i, k, a_tile(job, n, i, k)) : 0;
+            if(!ret) ret = ooc_read_tile(job->B, k, j, slot->b);
+            stats->io_seconds += omp_get_wtime() - start;
+            stats->tiles_read += read_a ? 2 : 1;
+            stats->bytes_read += (read_a ? tile_bytes(job->A) : 0) + tile_bytes(job->B);
+
+            if(!ret && read_a && last_a) drop_tile(job->A, i, k);
+            if(!ret && i == job->A->tile_rows - 1) drop_tile(job->B, k, j);
+
+            pthread_mutex_lock(&job->lock);
+            if(ret) {
+                job->status = ret;
+                job->abort = 1;
+            } else {
+                job->loaded = ++n;
+            }
+            pthread_cond_broadcast(&job->cond);
+            continue;
+        }
+
+        if(n == job->total && job->finished) break;
+
+        pthread_cond_wait(&job->cond, &job->lock);
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+static void free_job_buffers(ooc_job_t *job)
+{
+    if(job->slots) {
+        for(size_t s = 0; s < job->depth; s++)
+        {
+            free_matrix(job->slots[s].a);
+            free_matrix(job->slots[s].b);
+        }
+    }
+    free(job->slots);
+
+    if(job->panel) {
+        for(size_t p = 0; p < job->panel_rows * job->A->tile_cols; p++) free_matrix(job->panel[p]);
+    }
+    free(job->panel);
+
+    free_matrix(job->c_tiles[0]);
+    free_matrix(job->c_tiles[1]);
+}
+
+static int compute_tiles(ooc_job_t *job)
+{
+    const OocMatrix *A = job->A;
+    const OocMatrix *B = job->B;
+    OocStats *stats = job->stats;
+    size_t t = A->tile;
+    size_t n = 0;
+    int cur = 0;
+
+    for(size_t i = 0; i < A->tile_rows; i++)
+    {
+        for(size_t j = 0; j < B->tile_cols; j++)
+        {
+            Matrix *c = job->c_tiles[cur];
+            size_t m = (A->rows - i * t < t) ? A->rows - i * t : t;
+            size_t nc = (B->cols - j * t < t) ? B->cols - j * t : t;
+
+            double start = omp_get_wtime();
+            pthread_mutex_lock(&job->lock);
+            while(job->c_pending[cur] && !job->abort) pthread_cond_wait(&job->cond, &job->lock);
+            pthread_mutex_unlock(&job->lock);
+            stats->stall_seconds += omp_get_wtime() - start;
+
+            // Edge tiles leave part of the buffer untouched, and the file expects zeros there
+            if(m < t || nc < t) fill_matrix(c, 0.0);
+
+            for(size_t k = 0; k < A->tile_cols; k++, n++)
+            {
+                size_t kk = (A->cols - k * t < t) ? A->cols - k * t : t;
+
+                start = omp_get_wtime();
+                pthread_mutex_lock(&job->lock);
+                while(job->loaded <= n && !job->abort) pthread_cond_wait(&job->cond, &job->lock);
+                int abort = job->abort;
+                pthread_mutex_unlock(&job->lock);
+                stats->stall_seconds += omp_get_wtime() - start;
+                if(abort) return 0;
+
+                ooc_slot_t *slot = &job->slots[n % job->depth];
+                gemm_src_t a = gemm_src_a(a_tile(job, n, i, k)->data, t, 0);
+                gemm_src_t b = gemm_src_b(slot->b->data, t, 0);
+
+                start = omp_get_wtime();
+                int ret = gemm_packed(m, nc, kk, &a, &b, c->data, t, k > 0);
+                stats->compute_seconds += omp_get_wtime() - start;
+                if(ret) return ret;
+
+                pthread_mutex_lock(&job->lock);
+                job->consumed = n + 1;
+                pthread_cond_broadcast(&job->cond);
+                pthread_mutex_unlock(&job->lock);
+            }
+
+            pthread_mutex_lock(&job->lock);
+            job->c_index[cur] = i * B->tile_cols + j;
+            job->c_pending[cur] = 1;
+            pthread_cond_broadcast(&job->cond);
+            pthread_mutex_unlock(&job->lock);
+
+            cur ^= 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * C = A * B with all three operands on disk. Each row of A tiles stays resident while
+ * it meets every column of B, with the next row loading behind it, so A is read once
+ * and each step reads just its B tile (2 * tile^3 flops per tile^2 doubles). Memory use
+ * is 2 * tile_cols(A) + read_ahead + 2 tiles; if the panels don't fit, A streams with
+ * B instead and memory use drops to 2 * read_ahead + 2 tiles. Larger tiles shift the
+ * balance from disk bandwidth towards the in-memory kernel.
+ */
+int ooc_multiply(const OocMatrix *A, const OocMatrix *B, OocMatrix *C, size_t read_ahead, OocStats *stats)
+{
+    if(A == NULL || B == NULL || C == NULL) return 1;
+    if(A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) return 2;
+    if(A->tile != B->tile || A->tile != C->tile) return 2;
+    if(!C->writable) return 3;
+
+    OocStats local;
+    if(stats == NULL) stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    ooc_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.A = A;
+    job.B = B;
+    job.C = C;
+    job.depth = read_ahead ? read_ahead : OOC_READ_AHEAD;
+    job.total = A->tile_rows * B->tile_cols * A->tile_cols;
+    job.stats = stats;
+
+    size_t t = A->tile;
+    size_t tk = A->tile_cols;
+
+    job.panel_rows = (A->tile_rows > 1) ? 2 : 1;
+    job.panel = (Matrix **)calloc(job.panel_rows * tk, sizeof(Matrix *));
+    for(size_t p = 0; job.panel != NULL && p < job.panel_rows * tk; p++)
+    {
+        job.panel[p] = initialise_matrix(t, t);
+        if(job.panel[p] == NULL) {
+            for(size_t q = 0; q < p; q++) free_matrix(job.panel[q]);
+            free(job.panel);
+            job.panel = NULL;
+        }
+    }
+
+    job.slots = (ooc_slot_t *)calloc(job.depth, sizeof(ooc_slot_t));
+    job.c_tiles[0] = initialise_matrix(t, t);
+    job.c_tiles[1] = initialise_matrix(t, t);
+
+    int ret = (job.slots == NULL || job.c_tiles[0] == NULL || job.c_tiles[1] == NULL) ? 4 : 0;
+    for(size_t s = 0; s < job.depth && !ret; s++)
+    {
+        job.slots[s].a = job.panel ? NULL : initialise_matrix(t, t);
+        job.slots[s].b = initialise_matrix(t, t);
+        if((job.panel == NULL && job.slots[s].a == NULL) || job.slots[s].b == NULL) ret = 4;
+    }
+
+    if(ret) {
+        free_job_buffers(&job);
+        return ret;
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Row panels walk A in file order
+    if(job.panel) posix_fadvise(A->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    double start = omp_get_wtime();
+
+    pthread_t io;
+    if(pthread_create(&io, NULL, ooc_io_thread, &job)) {
+        ret = 4;
+    } else {
+        ret = compute_tiles(&job);
+
+        pthread_mutex_lock(&job.lock);
+        job.finished = 1;
+        if(ret) job.abort = 1;
+        pthread_cond_broadcast(&job.cond);
+        pthread_mutex_unlock(&job.lock);
+
+        pthread_join(io, NULL);
+        if(!ret) ret = job.status;
+        if(!ret && fdatasync(C->fd)) ret = 3;
+    }
+
+    stats->wall_seconds = omp_get_wtime() - start;
+    stats->flops = 2.0 * (double)A->rows * (double)B->cols * (double)A->cols;
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+    free_job_buffers(&job);
+
+    return ret;
+}
+
+void ooc_report(const OocStats *stats)
+{
+    if(stats == NULL) return;
+
+    double mb = 1024.0 * 1024.0;
+    double disk_bw = stats->io_seconds > 0.0 ? (double)(stats->bytes_read + stats->bytes_written) / mb / stats->io_seconds : 0.0;
+    double needed_bw = stats->compute_seconds > 0.0 ? (double)(stats->bytes_read + stats->bytes_written) / mb / stats->compute_seconds : 0.0;
+    double kernel_gflops = stats->compute_seconds > 0.0 ? stats->flops / stats->compute_seconds * 1e-9 : 0.0;
+    double gflops = stats->wall_seconds > 0.0 ? stats->flops / stats->wall_seconds * 1e-9 : 0.0;
+    double stall = stats->wall_seconds > 0.0 ? 100.0 * stats->stall_seconds / stats->wall_seconds : 0.0;
+
+    printf("Out-of-core GEMM: %.3g flops in %fs (%.2f GFLOP/s, kernel %.2f GFLOP/s)\n", stats->flops, stats->wall_seconds, gflops, kernel_gflops);
+    printf("I/O: %zu tiles read, %zu written, %.1f MB in %fs (%.1f MB/s disk, %.1f MB/s needed to keep the kernel busy)\n",
+           stats->tiles_read, stats->tiles_written, (double)(stats->bytes_read + stats->bytes_written) / mb,
+           stats->io_seconds, disk_bw, needed_bw);
+    printf("Compute stalled on I/O for %fs (%.1f%% of wall time): %s-bound\n", stats->stall_seconds, stall,
+           disk_bw >= needed_bw ? "compute" : "I/O");
+}
@@ -0,0 +1,54 @@
+#ifndef OOC_H
+#define OOC_H
+
+#include <stdlib.h>
+#include "matrix.h"
+
+/*
+ * File-backed matrices for products whose operands do not fit in memory. A file holds
+ * a small header followed by tile x tile blocks of doubles in row-major tile order;
+ * each block is row-major inside and zero-padded past the matrix edge.
+ */
+
+#define OOC_HEADER_BYTES 4096
+#define OOC_DEFAULT_TILE 2048
+#define OOC_READ_AHEAD 4
+
+typedef struct  {
+    int fd;
+    int writable;
+    size_t rows;
+    size_t cols;
+    size_t tile;
+    size_t tile_rows;
+    size_t tile_cols;
+} OocMatrix;
+
+typedef struct  {
+    size_t tiles_read;
+    size_t tiles_written;
+    size_t bytes_read;
+    size_t bytes_written;
+    double io_seconds;
+    double compute_seconds;
+    double stall_seconds;
+    double wall_seconds;
+    double flops;
+} OocStats;
+
+/* File Operations */
+OocMatrix* ooc_create(const char *path, size_t rows, size_t cols, size_t tile);
+OocMatrix* ooc_open(const char *path, int writable);
+void ooc_close(OocMatrix *matrix);
+
+/* Tile Access */
+int ooc_read_tile(const OocMatrix *matrix, size_t ti, size_t tj, Matrix *tile);
+int ooc_write_tile(OocMatrix *matrix, size_t ti, size_t tj, const Matrix *tile);
+int ooc_store(OocMatrix *dst, const Matrix *src);
+int ooc_load(const OocMatrix *src, Matrix *dst);
+
+/* Multiplication */
+int ooc_multiply(const OocMatrix *A, const OocMatrix *B, OocMatrix *C, size_t read_ahead, OocStats *stats);
+void ooc_report(const OocStats *stats);
+
+#endif // OOC_H
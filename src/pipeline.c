@@ -0,0 +1,746 @@
+#include "pipeline.h"
+#include "affinity.h"
+#include "gemm.h"
+#include <immintrin.h>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PIPE_SPINS_BEFORE_YIELD 64
+
+// One run's work for one stage; the pipeline keeps one per stage thread
+struct stage_job {
+    Pipeline *pipe;
+    size_t stage;
+    int train;
+    const Matrix *input;
+    const Matrix *target;
+    Matrix *output;
+    size_t micro_batch;
+    size_t num_micro;
+    double learning_rate;
+    double loss;
+};
+
+static void free_stage_buffers(stage_buffers_t *buf, size_t nl);
+
+static void free_channel(pipe_channel_t *ch)
+{
+    if(ch->pool) {
+        for(size_t i = 0; i < ch->pool_size; i++) free_matrix(ch->pool[i]);
+    }
+
+    free(ch->pool);
+    spsc_free(&ch->full);
+    spsc_free(&ch->empty);
+    memset(ch, 0, sizeof(*ch));
+}
+
+static int init_channel(pipe_channel_t *ch, size_t pool_size, size_t rows, size_t cols)
+{
+    memset(ch, 0, sizeof(*ch));
+
+    ch->pool = (Matrix **)calloc(pool_size, sizeof(Matrix *));
+    if(ch->pool == NULL) return 4;
+    ch->pool_size = pool_size;
+
+    if(spsc_init(&ch->full, pool_size) || spsc_init(&ch->empty, pool_size)) return 4;
+
+    for(size_t i = 0; i < pool_size; i++)
+    {
+        ch->pool[i] = initialise_matrix(rows, cols);
+        if(ch->pool[i] == NULL) return 4;
+    }
+
+    return 0;
+}
+
+static void reset_channel(pipe_channel_t *ch)
+{
+    atomic_store(&ch->full.head, 0);
+    atomic_store(&ch->full.tail, 0);
+    atomic_store(&ch->empty.head, 0);
+    atomic_store(&ch->empty.tail, 0);
+
+    for(size_t i = 0; i < ch->pool_size; i++) spsc_push(&ch->empty, ch->pool[i]);
+}
+
+static size_t stage_output_dim(const Pipeline *pipe, size_t s)
+{
+    const PipelineStage *st = &pipe->stages[s];
+    return pipe->nn->layers[st->first_layer + st->num_layers - 1].output_dim;
+}
+
+static void free_channels(Pipeline *pipe)
+{
+    for(size_t s = 0; s + 1 < pipe->num_stages; s++)
+    {
+        free_channel(&pipe->activations[s]);
+        free_channel(&pipe->gradients[s]);
+    }
+    pipe->channel_rows = 0;
+}
+
+static int prepare_channels(Pipeline *pipe, size_t micro_batch)
+{
+    // Enough buffers per link for every micro-batch a 1F1B schedule can have in flight
+    size_t pool_size = pipe->num_stages + 1;
+
+    if(pipe->channel_rows != micro_batch) {
+        free_channels(pipe);
+
+        for(size_t s = 0; s + 1 < pipe->num_stages; s++)
+        {
+            size_t cols = stage_output_dim(pipe, s);
+            if(init_channel(&pipe->activations[s], pool_size, micro_batch, cols) ||
+               init_channel(&pipe->gradients[s], pool_size, micro_batch, cols)) {
+                free_channels(pipe);
+                return 4;
+            }
+        }
+
+        pipe->channel_rows = micro_batch;
+    }
+
+    for(size_t s = 0; s + 1 < pipe->num_stages; s++)
+    {
+        reset_channel(&pipe->activations[s]);
+        reset_channel(&pipe->gradients[s]);
+    }
+
+    return 0;
+}
+
+// Multiply-adds per sample; conv weights are (kernel_h * kernel_w * in_c) x out_c
+static double layer_flops(const Layer *layer)
+{
+    double flops = (double)(layer->weights->rows * layer->weights->cols);
+    if(layer->type == conv2d) flops *= (double)(layer->conv->out_h * layer->conv->out_w);
+
+    return flops;
+}
+
+// Spins until an item is available; time spent here is the stage's pipeline bubble
+static Matrix* wait_pop(Pipeline *pipe, PipelineStage *st, spsc_ring_t *ring)
+{
+    Matrix *item = spsc_pop(ring);
+    if(item) return item;
+
+    double start = omp_get_wtime();
+    unsigned spins = 0;
+
+    while((item = spsc_pop(ring)) == NULL)
+    {
+        if(atomic_load_explicit(&pipe->abort, memory_order_relaxed)) break;
+
+        if(++spins % PIPE_SPINS_BEFORE_YIELD == 0) sched_yield();
+        else _mm_pause();
+    }
+
+    st->idle_seconds += omp_get_wtime() - start;
+    return item;
+}
+
+Pipeline* create_pipeline(NeuralNetwork *nn, size_t num_stages, const size_t *layers_per_stage, const int *threads_per_stage)
+{
+    if(nn == NULL || num_stages == 0 || num_stages > nn->num_layers) return NULL;
+
+    Pipeline *pipe = (Pipeline *)calloc(1, sizeof(Pipeline));
+    if(pipe == NULL) return NULL;
+
+    pipe->nn = nn;
+    pipe->num_stages = num_stages;
+    atomic_init(&pipe->abort, 0);
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->run, NULL);
+    pthread_cond_init(&pipe->done, NULL);
+
+    pipe->stages = (PipelineStage *)calloc(num_stages, sizeof(PipelineStage));
+    pipe->activations = (pipe_channel_t *)calloc(num_stages, sizeof(pipe_channel_t));
+    pipe->gradients = (pipe_channel_t *)calloc(num_stages, sizeof(pipe_channel_t));
+    pipe->threads = (pthread_t *)calloc(num_stages, sizeof(pthread_t));
+    pipe->jobs = (stage_job_t *)calloc(num_stages, sizeof(stage_job_t));
+    if(pipe->stages == NULL || pipe->activations == NULL || pipe->gradients == NULL || pipe->threads == NULL || pipe->jobs == NULL) {
+        free_pipeline(pipe);
+        return NULL;
+    }
+
+    size_t L = nn->num_layers;
+
+    if(layers_per_stage) {
+        size_t layer = 0;
+        for(size_t s = 0; s < num_stages; s++)
+        {
+            if(layers_per_stage[s] == 0) break;
+            pipe->stages[s].first_layer = layer;
+            pipe->stages[s].num_layers = layers_per_stage[s];
+            layer += layers_per_stage[s];
+        }
+
+        if(layer != L || pipe->stages[num_stages - 1].num_layers == 0) {
+            free_pipeline(pipe);
+            return NULL;
+        }
+    } else {
+        // Greedy contiguous split balancing per-layer FLOPs
+        double remaining = 0.0;
+        for(size_t i = 0; i < L; i++) remaining += layer_flops(&nn->layers[i]);
+
+        size_t layer = 0;
+        for(size_t s = 0; s < num_stages; s++)
+        {
+            size_t stages_left = num_stages - s;
+            double target = remaining / (double)stages_left;
+            double acc = 0.0;
+
+            pipe->stages[s].first_layer = layer;
+
+            do {
+                acc += layer_flops(&nn->layers[layer]);
+                layer++;
+            } while(layer + stages_left - 1 < L &&
+                    (s == num_stages - 1 || acc + 0.5 * layer_flops(&nn->layers[layer]) <= target));
+
+            pipe->stages[s].num_layers = layer - pipe->stages[s].first_layer;
+            remaining -= acc;
+        }
+    }
+
+    int default_threads = omp_get_max_threads() / (int)num_stages;
+    int first_cpu = 0;
+
+    for(size_t s = 0; s < num_stages; s++)
+    {
+        int threads = threads_per_stage ? threads_per_stage[s] : default_threads;
+        pipe->stages[s].num_threads = threads > 0 ? threads : 1;
+        pipe->stages[s].first_cpu = first_cpu;
+        first_cpu += pipe->stages[s].num_threads;
+    }
+
+    return pipe;
+}
+
+void free_pipeline(Pipeline *pipe)
+{
+    if(pipe == NULL) return;
+
+    // Parked stage threads release their workspaces on the way out
+    if(pipe->threads_started) {
+        pthread_mutex_lock(&pipe->lock);
+        pipe->shutdown = 1;
+        pthread_cond_broadcast(&pipe->run);
+        pthread_mutex_unlock(&pipe->lock);
+
+        for(size_t s = 0; s < pipe->threads_started; s++) pthread_join(pipe->threads[s], NULL);
+    }
+
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->run);
+    pthread_cond_destroy(&pipe->done);
+
+    if(pipe->activations && pipe->gradients) free_channels(pipe);
+
+    if(pipe->stages) {
+        for(size_t s = 0; s < pipe->num_stages; s++) free_stage_buffers(pipe->stages[s].buffers, pipe->stages[s].num_layers);
+    }
+
+    free(pipe->activations);
+    free(pipe->gradients);
+    free(pipe->stages);
+    free(pipe->threads);
+    free(pipe->jobs);
+    free(pipe);
+}
+
+// Pins each stage's OpenMP team to its own contiguous CPU range on the next run
+int pipeline_set_pinning(Pipeline *pipe, int pin_threads)
+{
+    if(pipe == NULL) return 1;
+
+    pipe->pin_threads = pin_threads ? 1 : 0;
+    return 0;
+}
+
+/*
+ * Per-stage working set, cached across runs. Under 1F1B stage s never holds more than
+ * num_stages - s micro-batches between their forward and backward, so training keeps
+ * that many activation slots and micro-batch m uses slot m % slots.
+ */
+struct stage_buffers {
+    size_t rows;
+    size_t slots;
+    int train;
+    Matrix **in;
+    Matrix **lin;
+    Matrix **act;
+    Matrix **grad;
+    Matrix **delta;
+    Matrix **gw;
+    Matrix **gb;
+    Matrix **gw_acc;
+    Matrix **gb_acc;
+};
+
+static void free_stage_buffers(stage_buffers_t *buf, size_t nl)
+{
+    if(buf == NULL) return;
+
+    for(size_t i = 0; i < buf->slots; i++)
+    {
+        if(buf->in) free_matrix(buf->in[i]);
+        for(size_t l = 0; l < nl; l++)
+        {
+            if(buf->lin) free_matrix(buf->lin[i * nl + l]);
+            if(buf->act) free_matrix(buf->act[i * nl + l]);
+        }
+    }
+
+    for(size_t l = 0; l <= nl; l++)
+    {
+        if(buf->grad) free_matrix(buf->grad[l]);
+        if(l == nl) break;
+        if(buf->delta) free_matrix(buf->delta[l]);
+        if(buf->gw) free_matrix(buf->gw[l]);
+        if(buf->gb) free_matrix(buf->gb[l]);
+        if(buf->gw_acc) free_matrix(buf->gw_acc[l]);
+        if(buf->gb_acc) free_matrix(buf->gb_acc[l]);
+    }
+
+    free(buf->in);
+    free(buf->lin);
+    free(buf->act);
+    free(buf->grad);
+    free(buf->delta);
+    free(buf->gw);
+    free(buf->gb);
+    free(buf->gw_acc);
+    free(buf->gb_acc);
+    free(buf);
+}
+
+static int alloc_stage_buffers(stage_buffers_t *buf, const stage_job_t *job, size_t slots)
+{
+    const PipelineStage *st = &job->pipe->stages[job->stage];
+    Layer *layers = job->pipe->nn->layers + st->first_layer;
+    size_t nl = st->num_layers;
+    size_t mb = job->micro_batch;
+
+    buf->rows = mb;
+    buf->slots = slots;
+    buf->train = job->train;
+
+    buf->in = (Matrix **)calloc(buf->slots, sizeof(Matrix *));
+    buf->lin = (Matrix **)calloc(buf->slots * nl, sizeof(Matrix *));
+    buf->act = (Matrix **)calloc(buf->slots * nl, sizeof(Matrix *));
+    if(buf->in == NULL || buf->lin == NULL || buf->act == NULL) return 4;
+
+    for(size_t i = 0; i < buf->slots; i++)
+    {
+        if(job->stage > 0) {
+            buf->in[i] = initialise_matrix(mb, layers[0].input_dim);
+            if(buf->in[i] == NULL) return 4;
+        }
+
+        for(size_t l = 0; l < nl; l++)
+        {
+            buf->lin[i * nl + l] = initialise_matrix(mb, layers[l].output_dim);
+            buf->act[i * nl + l] = initialise_matrix(mb, layers[l].output_dim);
+            if(buf->lin[i * nl + l] == NULL || buf->act[i * nl + l] == NULL) return 4;
+        }
+    }
+
+    if(!job->train) return 0;
+
+    buf->grad = (Matrix **)calloc(nl + 1, sizeof(Matrix *));
+    buf->delta = (Matrix **)calloc(nl, sizeof(Matrix *));
+    buf->gw = (Matrix **)calloc(nl, sizeof(Matrix *));
+    buf->gb = (Matrix **)calloc(nl, sizeof(Matrix *));
+    buf->gw_acc = (Matrix **)calloc(nl, sizeof(Matrix *));
+    buf->gb_acc = (Matrix **)calloc(nl, sizeof(Matrix *));
+    if(buf->grad == NULL || buf->delta == NULL || buf->gw == NULL || buf->gb == NULL || buf->gw_acc == NULL || buf->gb_acc == NULL) return 4;
+
+    // grad[l] is the gradient w.r.t. the input of layer l, grad[nl] w.r.t. the stage output
+    for(size_t l = 0; l <= nl; l++)
+    {
+        buf->grad[l] = initialise_matrix(mb, l < nl ? layers[l].input_dim : layers[nl - 1].output_dim);
+        if(buf->grad[l] == NULL) return 4;
+    }
+
+    for(size_t l = 0; l < nl; l++)
+    {
+        buf->delta[l] = initialise_matrix(mb, layers[l].output_dim);
+        buf->gw[l] = initialise_matrix(layers[l].weights->rows, layers[l].weights->cols);
+        buf->gb[l] = initialise_matrix(layers[l].biases->rows, 1);
+        buf->gw_acc[l] = initialise_matrix(layers[l].weights->rows, layers[l].weights->cols);
+        buf->gb_acc[l] = initialise_matrix(layers[l].biases->rows, 1);
+        if(buf->delta[l] == NULL || buf->gw[l] == NULL || buf->gb[l] == NULL || buf->gw_acc[l] == NULL || buf->gb_acc[l] == NULL) return 4;
+    }
+
+    return 0;
+}
+
+// Reuses the stage's cached buffers when they are large enough for this run
+static stage_buffers_t* stage_buffers(const stage_job_t *job)
+{
+    PipelineStage *st = &job->pipe->stages[job->stage];
+    size_t slots = 1;
+
+    if(job->train) {
+        slots = job->pipe->num_stages - job->stage;
+        if(slots > job->num_micro) slots = job->num_micro;
+    }
+
+    stage_buffers_t *buf = st->buffers;
+    if(buf && buf->rows == job->micro_batch && buf->slots >= slots && (buf->train || !job->train)) return buf;
+
+    free_stage_buffers(buf, st->num_layers);
+    st->buffers = NULL;
+
+    buf = (stage_buffers_t *)calloc(1, sizeof(stage_buffers_t));
+    if(buf == NULL) return NULL;
+
+    if(alloc_stage_buffers(buf, job, slots)) {
+        free_stage_buffers(buf, st->num_layers);
+        return NULL;
+    }
+
+    st->buffers = buf;
+    return buf;
+}
+
+static Matrix row_view(const Matrix *matrix, size_t row0, size_t rows)
+{
+    Matrix view = { rows, matrix->cols, matrix->data + row0 * matrix->cols, NULL, 0 };
+    return view;
+}
+
+static size_t micro_rows(const stage_job_t *job, size_t m)
+{
+    size_t row0 = m * job->micro_batch;
+    size_t left = job->input->rows - row0;
+    return left < job->micro_batch ? left : job->micro_batch;
+}
+
+static int stage_forward(stage_job_t *job, stage_buffers_t *buf, size_t m)
+{
+    Pipeline *pipe = job->pipe;
+    PipelineStage *st = &pipe->stages[job->stage];
+    Layer *layers = pipe->nn->layers + st->first_layer;
+    size_t nl = st->num_layers;
+    size_t slot = m % buf->slots;
+    size_t rows = micro_rows(job, m);
+
+    Matrix in_view;
+    const Matrix *x;
+
+    if(job->stage == 0) {
+        in_view = row_view(job->input, m * job->micro_batch, rows);
+        x = &in_view;
+    } else {
+        pipe_channel_t *ch = &pipe->activations[job->stage - 1];
+        Matrix *msg = wait_pop(pipe, st, &ch->full);
+        if(msg == NULL) return 7;
+
+        Matrix *dst = buf->in[slot];
+        dst->rows = rows;
+        memcpy(dst->data, msg->data, rows * msg->cols * sizeof(double));
+        spsc_push(&ch->empty, msg);
+        x = dst;
+    }
+
+    int ret;
+    for(size_t l = 0; l < nl; l++)
+    {
+        Matrix *lin = buf->lin[slot * nl + l];
+        Matrix *act = buf->act[slot * nl + l];
+        lin->rows = rows;
+        act->rows = rows;
+
+        ret = layer_forward_cached(&layers[l], x, lin, act);
+        if(ret) return ret;
+        x = act;
+    }
+
+    if(job->stage + 1 < pipe->num_stages) {
+        pipe_channel_t *ch = &pipe->activations[job->stage];
+        Matrix *msg = wait_pop(pipe, st, &ch->empty);
+        if(msg == NULL) return 7;
+
+        msg->rows = rows;
+        memcpy(msg->data, x->data, rows * x->cols * sizeof(double));
+        spsc_push(&ch->full, msg);
+    } else if(!job->train) {
+        memcpy(job->output->data + m * job->micro_batch * job->output->cols, x->data, rows * x->cols * sizeof(double));
+    }
+
+    st->forward_count++;
+    return 0;
+}
+
+static int stage_backward(stage_job_t *job, stage_buffers_t *buf, size_t m)
+{
+    Pipeline *pipe = job->pipe;
+    PipelineStage *st = &pipe->stages[job->stage];
+    Layer *layers = pipe->nn->layers + st->first_layer;
+    size_t nl = st->num_layers;
+    size_t slot = m % buf->slots;
+    size_t rows = micro_rows(job, m);
+
+    Matrix *grad_out = buf->grad[nl];
+    grad_out->rows = rows;
+
+    if(job->stage + 1 == pipe->num_stages) {
+        // MSE over the whole batch, so summing micro-batch gradients gives the full-batch gradient
+        const Matrix *out = buf->act[slot * nl + nl - 1];
+        Matrix target = row_view(job->target, m * job->micro_batch, rows);
+        size_t n = rows * out->cols;
+        double scale = 2.0 / (double)(job->input->rows * out->cols);
+        double loss = 0.0;
+
+        for(size_t i = 0; i < n; i++)
+        {
+            double diff = out->data[i] - target.data[i];
+            loss += diff * diff;
+            grad_out->data[i] = scale * diff;
+        }
+
+        job->loss += loss / (double)(job->input->rows * out->cols);
+    } else {
+        pipe_channel_t *ch = &pipe->gradients[job->stage];
+        Matrix *msg = wait_pop(pipe, st, &ch->full);
+        if(msg == NULL) return 7;
+
+        memcpy(grad_out->data, msg->data, rows * msg->cols * sizeof(double));
+        spsc_push(&ch->empty, msg);
+    }
+
+    Matrix in_view;
+    if(job->stage == 0) in_view = row_view(job->input, m * job->micro_batch, rows);
+
+    int ret;
+    for(size_t l = nl; l-- > 0;)
+    {
+        const Matrix *x;
+        if(l > 0) x = buf->act[slot * nl + l - 1];
+        else x = (job->stage == 0) ? &in_view : buf->in[slot];
+
+        Matrix *grad_in = (job->stage == 0 && l == 0) ? NULL : buf->grad[l];
+        if(grad_in) grad_in->rows = rows;
+        buf->delta[l]->rows = rows;
+
+        ret = layer_backward_workspace(&layers[l], x, buf->lin[slot * nl + l], buf->grad[l + 1], buf->delta[l],
+                                       grad_in, buf->gw[l], buf->gb[l]);
+        if(ret) return ret;
+
+        size_t nw = buf->gw[l]->rows * buf->gw[l]->cols;
+        size_t nb = buf->gb[l]->rows;
+
+        // Micro-batches run backward in order, so the first one resets the cached accumulators
+        if(m == 0) {
+            memcpy(buf->gw_acc[l]->data, buf->gw[l]->data, nw * sizeof(double));
+            memcpy(buf->gb_acc[l]->data, buf->gb[l]->data, nb * sizeof(double));
+            continue;
+        }
+
+        #pragma omp parallel for simd schedule(static)
+        for(size_t i = 0; i < nw; i++) buf->gw_acc[l]->data[i] += buf->gw[l]->data[i];
+
+        for(size_t i = 0; i < nb; i++) buf->gb_acc[l]->data[i] += buf->gb[l]->data[i];
+    }
+
+    if(job->stage > 0) {
+        pipe_channel_t *ch = &pipe->gradients[job->stage - 1];
+        Matrix *msg = wait_pop(pipe, st, &ch->empty);
+        if(msg == NULL) return 7;
+
+        msg->rows = rows;
+        memcpy(msg->data, buf->grad[0]->data, rows * buf->grad[0]->cols * sizeof(double));
+        spsc_push(&ch->full, msg);
+    }
+
+    st->backward_count++;
+    return 0;
+}
+
+/*
+ * One stage's share of a run. Inference streams forwards only; training runs 1F1B:
+ * enough warm-up forwards to fill the downstream stages, then alternating
+ * forward/backward, then the remaining backwards, so each stage's backward overlaps
+ * the others' forwards.
+ */
+static void run_stage(stage_job_t *job)
+{
+    Pipeline *pipe = job->pipe;
+    PipelineStage *st = &pipe->stages[job->stage];
+
+    stage_buffers_t *buf = stage_buffers(job);
+    int ret = buf ? 0 : 4;
+
+    // Started after the buffers are ready, so a one-off allocation isn't reported as busy time
+    double start = omp_get_wtime();
+
+    if(!ret && !job->train) {
+        for(size_t m = 0; m < job->num_micro && !ret; m++) ret = stage_forward(job, buf, m);
+    } else if(!ret) {
+        size_t warmup = pipe->num_stages - job->stage - 1;
+        if(warmup > job->num_micro) warmup = job->num_micro;
+
+        size_t f = 0, b = 0;
+        while(f < warmup && !ret) ret = stage_forward(job, buf, f++);
+
+        while(f < job->num_micro && !ret)
+        {
+            ret = stage_forward(job, buf, f++);
+            if(!ret) ret = stage_backward(job, buf, b++);
+        }
+
+        while(b < job->num_micro && !ret) ret = stage_backward(job, buf, b++);
+
+        Layer *layers = pipe->nn->layers + st->first_layer;
+        for(size_t l = 0; l < st->num_layers && !ret; l++)
+        {
+            ret = layer_update(&layers[l], buf->gw_acc[l], buf->gb_acc[l], job->learning_rate);
+        }
+    }
+
+    if(ret) atomic_store(&pipe->abort, 1);
+
+    st->busy_seconds = omp_get_wtime() - start - st->idle_seconds;
+    st->status = ret;
+}
+
+// Parks between runs, so the thread, its OpenMP team and its workspaces survive across steps
+static void* stage_worker(void *arg)
+{
+    stage_job_t *job = (stage_job_t *)arg;
+    Pipeline *pipe = job->pipe;
+    PipelineStage *st = &pipe->stages[job->stage];
+    unsigned long seen = 0;
+    int pinned = 0;
+
+    omp_set_num_threads(st->num_threads);
+
+    pthread_mutex_lock(&pipe->lock);
+    for(;;)
+    {
+        while(pipe->generation == seen && !pipe->shutdown) pthread_cond_wait(&pipe->run, &pipe->lock);
+        if(pipe->shutdown) break;
+
+        seen = pipe->generation;
+        pthread_mutex_unlock(&pipe->lock);
+
+        if(pipe->pin_threads && !pinned) pinned = !affinity_pin_threads_from(st->first_cpu);
+        run_stage(job);
+
+        pthread_mutex_lock(&pipe->lock);
+        pipe->finished++;
+        pthread_cond_signal(&pipe->done);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    gemm_release_workspace();
+    conv_release_workspace();
+
+    return NULL;
+}
+
+static int run_pipeline(Pipeline *pipe, stage_job_t *proto)
+{
+    size_t S = pipe->num_stages;
+
+    int ret = prepare_channels(pipe, proto->micro_batch);
+    if(ret) return ret;
+
+    for(size_t s = 0; s < S; s++)
+    {
+        PipelineStage *st = &pipe->stages[s];
+        st->busy_seconds = 0.0;
+        st->idle_seconds = 0.0;
+        st->forward_count = 0;
+        st->backward_count = 0;
+        st->status = 0;
+
+        pipe->jobs[s] = *proto;
+        pipe->jobs[s].stage = s;
+        pipe->jobs[s].loss = 0.0;
+    }
+
+    // Threads start with the first run; one that failed to start is retried on the next
+    while(pipe->threads_started < S)
+    {
+        size_t s = pipe->threads_started;
+        if(pthread_create(&pipe->threads[s], NULL, stage_worker, &pipe->jobs[s])) return 4;
+        pipe->threads_started++;
+    }
+
+    atomic_store(&pipe->abort, 0);
+    double start = omp_get_wtime();
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->finished = 0;
+    pipe->generation++;
+    pthread_cond_broadcast(&pipe->run);
+    while(pipe->finished < S) pthread_cond_wait(&pipe->done, &pipe->lock);
+    pthread_mutex_unlock(&pipe->lock);
+
+    pipe->wall_seconds = omp_get_wtime() - start;
+    pipe->samples = proto->input->rows;
+
+    for(size_t s = 0; s < S && !ret; s++) ret = pipe->stages[s].status;
+
+    proto->loss = pipe->jobs[S - 1].loss;
+
+    return ret;
+}
+
+int pipeline_forward(Pipeline *pipe, const Matrix *input, Matrix *output, size_t micro_batch)
+{
+    if(pipe == NULL || input == NULL || output == NULL) return 1;
+    if(micro_batch == 0 || input->rows == 0) return 2;
+    if(input->cols != pipe->nn->layers[0].input_dim) return 2;
+    if(output->rows != input->rows || output->cols != stage_output_dim(pipe, pipe->num_stages - 1)) return 2;
+
+    stage_job_t job = { pipe, 0, 0, input, NULL, output, micro_batch, (input->rows + micro_batch - 1) / micro_batch, 0.0, 0.0 };
+
+    return run_pipeline(pipe, &job);
+}
+
+int pipeline_train_step(Pipeline *pipe, const Matrix *input, const Matrix *target, size_t micro_batch, double learning_rate, double *loss)
+{
+    if(pipe == NULL || input == NULL || target == NULL) return 1;
+    if(micro_batch == 0 || input->rows == 0) return 2;
+    if(input->cols != pipe->nn->layers[0].input_dim) return 2;
+    if(target->rows != input->rows || target->cols != stage_output_dim(pipe, pipe->num_stages - 1)) return 2;
+
+    stage_job_t job = { pipe, 0, 1, input, target, NULL, micro_batch, (input->rows + micro_batch - 1) / micro_batch, learning_rate, 0.0 };
+
+    int ret = run_pipeline(pipe, &job);
+    if(loss) *loss = job.loss;
+
+    return ret;
+}
+
+void pipeline_report(const Pipeline *pipe)
+{
+    if(pipe == NULL) return;
+
+    printf("Pipeline: %zu stages, %zu samples in %fs (%.1f samples/s)\n", pipe->num_stages, pipe->samples,
+           pipe->wall_seconds, pipe->wall_seconds > 0.0 ? (double)pipe->samples / pipe->wall_seconds : 0.0);
+    printf("%-6s %-9s %-8s %-6s %-6s %-10s %-10s %-8s %-10s\n",
+           "stage", "layers", "threads", "fwd", "bwd", "busy(s)", "idle(s)", "bubble", "mb/s");
+
+    for(size_t s = 0; s < pipe->num_stages; s++)
+    {
+        const PipelineStage *st = &pipe->stages[s];
+        double total = st->busy_seconds + st->idle_seconds;
+        double bubble = total > 0.0 ? 100.0 * st->idle_seconds / total : 0.0;
+        double rate = st->busy_seconds > 0.0 ? (double)(st->forward_count + st->backward_count) / st->busy_seconds : 0.0;
+
+        printf("%-6zu %3zu-%-5zu %-8d %-6zu %-6zu %-10f %-10f %6.1f%% %-10.1f\n", s, st->first_layer,
+               st->first_layer + st->num_layers - 1, st->num_threads, st->forward_count, st->backward_count,
+               st->busy_seconds, st->idle_seconds, bubble, rate);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "neural_net.h"
+#include "ring.h"
+
+/*
+ * Layer-pipelined execution. Contiguous layer ranges run as stages on their own
+ * threads (each with its own OpenMP team), and micro-batches stream between stages
+ * through lock-free single-producer/single-consumer rings of activation matrices.
+ * Stage threads start with the first run and stay parked between runs, keeping their
+ * teams and GEMM/conv workspaces, until free_pipeline.
+ */
+
+typedef struct stage_buffers stage_buffers_t;
+typedef struct stage_job stage_job_t;
+
+// Bounded message channel: full carries filled buffers downstream, empty returns them
+typedef struct  {
+    spsc_ring_t full;
+    spsc_ring_t empty;
+    Matrix **pool;
+    size_t pool_size;
+} pipe_channel_t;
+
+typedef struct  {
+    size_t first_layer;
+    size_t num_layers;
+    int num_threads;
+    int first_cpu;
+    stage_buffers_t *buffers;
+
+    /* Statistics for the last run */
+    double busy_seconds;
+    double idle_seconds;
+    size_t forward_count;
+    size_t backward_count;
+    int status;
+} PipelineStage;
+
+typedef struct  {
+    NeuralNetwork *nn;
+    size_t num_stages;
+    PipelineStage *stages;
+    pipe_channel_t *activations;
+    pipe_channel_t *gradients;
+    size_t channel_rows;
+    int pin_threads;
+    atomic_int abort;
+
+    /* Stage threads; runs are handed out by bumping generation */
+    pthread_t *threads;
+    stage_job_t *jobs;
+    size_t threads_started;
+    pthread_mutex_t lock;
+    pthread_cond_t run;
+    pthread_cond_t done;
+    unsigned long generation;
+    size_t finished;
+    int shutdown;
+
+    double wall_seconds;
+    size_t samples;
+} Pipeline;
+
+/* Pipeline Operations */
+Pipeline* create_pipeline(NeuralNetwork *nn, size_t num_stages, const size_t *layers_per_stage, const int *threads_per_stage);
+void free_pipeline(Pipeline *pipe);
+int pipeline_set_pinning(Pipeline *pipe, int pin_threads);
+int pipeline_forward(Pipeline *pipe, const Matrix *input, Matrix *output, size_t micro_batch);
+int pipeline_train_step(Pipeline *pipe, const Matrix *input, const Matrix *target, size_t micro_batch, double learning_rate, double *loss);
+void pipeline_report(const Pipeline *pipe);
+
+#endif // PIPELINE_H
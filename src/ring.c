@@ -0,0 +1,50 @@
+#include "ring.h"
+
+int spsc_init(spsc_ring_t *ring, size_t capacity)
+{
+    if(ring == NULL || capacity == 0) return 1;
+
+    ring->slots = (Matrix **)calloc(capacity, sizeof(Matrix *));
+    if(ring->slots == NULL) return 4;
+
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return 0;
+}
+
+void spsc_free(spsc_ring_t *ring)
+{
+    if(ring == NULL) return;
+
+    free(ring->slots);
+    ring->slots = NULL;
+    ring->capacity = 0;
+}
+
+// Producer side only
+int spsc_push(spsc_ring_t *ring, Matrix *item)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if(tail - head == ring->capacity) return 1;
+
+    ring->slots[tail % ring->capacity] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return 0;
+}
+
+// Consumer side only
+Matrix* spsc_pop(spsc_ring_t *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if(head == tail) return NULL;
+
+    Matrix *item = ring->slots[head % ring->capacity];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return item;
+}
@@ -0,0 +1,21 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "matrix.h"
+
+/* Lock-free single-producer/single-consumer ring of Matrix pointers */
+typedef struct  {
+    Matrix **slots;
+    size_t capacity;
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+} spsc_ring_t;
+
+int spsc_init(spsc_ring_t *ring, size_t capacity);
+void spsc_free(spsc_ring_t *ring);
+int spsc_push(spsc_ring_t *ring, Matrix *item);
+Matrix* spsc_pop(spsc_ring_t *ring);
+
+#endif // RING_H
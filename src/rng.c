@@ -0,0 +1,217 @@
+#include "rng.h"
+#include <immintrin.h>
+#include <math.h>
+#include <omp.h>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+#define RNG_DEFAULT_SEED 0x5EED5EED5EED5EEDull
+
+// Elements per parallel work item. Must be a multiple of 8 so the SIMD/scalar split
+// inside a chunk never depends on how chunks are distributed across threads.
+#define RNG_CHUNK 4096
+
+static uint64_t rng_seed = RNG_DEFAULT_SEED;
+static uint64_t rng_stream = 0;
+
+void rng_set_seed(uint64_t seed)
+{
+    rng_seed = seed;
+    rng_stream = 0;
+}
+
+uint64_t rng_get_seed(void)
+{
+    return rng_seed;
+}
+
+uint64_t rng_next_stream(void)
+{
+    uint64_t stream;
+
+    #pragma omp atomic capture
+    stream = rng_stream++;
+
+    return stream;
+}
+
+void philox4x32(uint64_t counter, uint64_t stream, uint64_t seed, uint32_t out[4])
+{
+    uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32);
+    uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+
+    for(int r = 0; r < PHILOX_ROUNDS; r++)
+    {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+
+        c0 = n0;
+        c1 = (uint32_t)p1;
+        c2 = n2;
+        c3 = (uint32_t)p0;
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Top 52 bits of (hi:lo) as a double in [0, 1)
+static inline double bits_to_unit(uint32_t hi, uint32_t lo)
+{
+    union { uint64_t u; double d; } conv;
+    conv.u = ((((uint64_t)hi << 32) | lo) >> 12) | 0x3FF0000000000000ull;
+    return conv.d - 1.0;
+}
+
+#ifdef __AVX2__
+// Four Philox blocks at once, one per 64-bit lane with each 32-bit word kept in the low half
+static void philox4x32_x4(uint64_t counter, uint64_t stream, uint64_t seed, double *dst)
+{
+    const __m256i mask = _mm256_set1_epi64x(0xFFFFFFFFll);
+    const __m256i m0 = _mm256_set1_epi64x(PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi64x(PHILOX_M1);
+
+    __m256i ctr = _mm256_add_epi64(_mm256_set1_epi64x((long long)counter), _mm256_setr_epi64x(0, 1, 2, 3));
+    __m256i c0 = _mm256_and_si256(ctr, mask);
+    __m256i c1 = _mm256_srli_epi64(ctr, 32);
+    __m256i c2 = _mm256_set1_epi64x((uint32_t)stream);
+    __m256i c3 = _mm256_set1_epi64x((uint32_t)(stream >> 32));
+
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+
+    for(int r = 0; r < PHILOX_ROUNDS; r++)
+    {
+        __m256i p0 = _mm256_mul_epu32(c0, m0);
+        __m256i p1 = _mm256_mul_epu32(c2, m1);
+
+        __m256i n0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), c1), _mm256_set1_epi64x(k0));
+        __m256i n2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), c3), _mm256_set1_epi64x(k1));
+
+        c0 = n0;
+        c1 = _mm256_and_si256(p1, mask);
+        c2 = n2;
+        c3 = _mm256_and_si256(p0, mask);
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    const __m256i exponent = _mm256_set1_epi64x(0x3FF0000000000000ll);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    __m256i bits_even = _mm256_srli_epi64(_mm256_or_si256(_mm256_slli_epi64(c0, 32), c1), 12);
+    __m256i bits_odd = _mm256_srli_epi64(_mm256_or_si256(_mm256_slli_epi64(c2, 32), c3), 12);
+
+    __m256d even = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(bits_even, exponent)), one);
+    __m256d odd = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(bits_odd, exponent)), one);
+
+    // even = {e0, e2, e4, e6}, odd = {e1, e3, e5, e7}
+    __m256d lo = _mm256_unpacklo_pd(even, odd);
+    __m256d hi = _mm256_unpackhi_pd(even, odd);
+
+    _mm256_storeu_pd(dst, _mm256_permute2f128_pd(lo, hi, 0x20));
+    _mm256_storeu_pd(dst + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+}
+#endif
+
+// Unit uniforms for elements [first, first + count); first must be even
+static void uniform_chunk(double *dst, size_t first, size_t count, uint64_t seed, uint64_t stream)
+{
+    size_t i = 0;
+
+#ifdef __AVX2__
+    for(; i + 8 <= count; i += 8)
+    {
+        philox4x32_x4((first + i) / 2, stream, seed, dst + i);
+    }
+#endif
+
+    uint32_t block[4];
+    for(; i < count; i += 2)
+    {
+        philox4x32((first + i) / 2, stream, seed, block);
+        dst[i] = bits_to_unit(block[0], block[1]);
+        if(i + 1 < count) dst[i + 1] = bits_to_unit(block[2], block[3]);
+    }
+}
+
+int rng_fill_uniform(double *data, size_t n, uint64_t seed, uint64_t stream, double lower_bound, double upper_bound)
+{
+    if(data == NULL) return 1;
+
+    double range = upper_bound - lower_bound;
+    size_t num_chunks = (n + RNG_CHUNK - 1) / RNG_CHUNK;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t c = 0; c < num_chunks; c++)
+    {
+        size_t first = c * RNG_CHUNK;
+        size_t count = (n - first < RNG_CHUNK) ? n - first : RNG_CHUNK;
+        double *dst = data + first;
+
+        uniform_chunk(dst, first, count, seed, stream);
+
+        #pragma omp simd
+        for(size_t i = 0; i < count; i++)
+        {
+            dst[i] = lower_bound + range * dst[i];
+        }
+    }
+
+    return 0;
+}
+
+int rng_fill_normal(double *data, size_t n, uint64_t seed, uint64_t stream, double mean, double stddev)
+{
+    if(data == NULL) return 1;
+
+    const double two_pi = 6.283185307179586;
+    size_t num_chunks = (n + RNG_CHUNK - 1) / RNG_CHUNK;
+
+    #pragma omp parallel for schedule(static)
+    for(size_t c = 0; c < num_chunks; c++)
+    {
+        size_t first = c * RNG_CHUNK;
+        size_t count = (n - first < RNG_CHUNK) ? n - first : RNG_CHUNK;
+        double *dst = data + first;
+
+        uniform_chunk(dst, first, count, seed, stream);
+
+        // Box-Muller on each (even, odd) pair; 1 - u keeps the log argument in (0, 1]
+        size_t pairs = count / 2;
+
+        #pragma omp simd
+        for(size_t p = 0; p < pairs; p++)
+        {
+            double r = sqrt(-2.0 * log(1.0 - dst[2 * p]));
+            double theta = two_pi * dst[2 * p + 1];
+            dst[2 * p] = mean + stddev * r * cos(theta);
+            dst[2 * p + 1] = mean + stddev * r * sin(theta);
+        }
+
+        if(count % 2) {
+            uint32_t block[4];
+            size_t last = first + count - 1;
+            philox4x32(last / 2, stream, seed, block);
+
+            double r = sqrt(-2.0 * log(1.0 - bits_to_unit(block[0], block[1])));
+            double theta = two_pi * bits_to_unit(block[2], block[3]);
+            dst[count - 1] = mean + stddev * r * cos(theta);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Counter-based Philox4x32-10 generator. Element i of a fill is derived only from
+ * (seed, stream, i), so results are bitwise identical for any number of threads.
+ */
+
+/* Global Seed State */
+void rng_set_seed(uint64_t seed);
+uint64_t rng_get_seed(void);
+uint64_t rng_next_stream(void);
+
+/* Generators */
+void philox4x32(uint64_t counter, uint64_t stream, uint64_t seed, uint32_t out[4]);
+int rng_fill_uniform(double *data, size_t n, uint64_t seed, uint64_t stream, double lower_bound, double upper_bound);
+int rng_fill_normal(double *data, size_t n, uint64_t seed, uint64_t stream, double mean, double stddev);
+
+#endif // RNG_H